@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# usage: plot_sweep.py sweep.csv sweep.svg
+# heatmap of the median runtimes written by run_sweep.sh: a row per threshold, a column per percent likelihood,
+# from green (fastest) to red (slowest). Plain SVG, no plotting library needed
+import csv
+import sys
+
+CELL_W, CELL_H, LEFT, TOP = 64, 28, 90, 50
+
+
+def color(t):
+    # green -> yellow -> red
+    r, g = (int(510 * t), 200) if t < 0.5 else (255, int(200 * (2 - 2 * t)))
+    return "rgb(%d,%d,60)" % (min(r, 255), g)
+
+
+def row_key(threshold):
+    return (0, 0.0) if threshold == "none" else (1, 0.0) if threshold == "model" else (2, float(threshold))
+
+
+def main(csv_path, svg_path):
+    with open(csv_path) as f:
+        cells = {(row["threshold"], int(row["likelihood"])): float(row["median_s"]) for row in csv.DictReader(f)}
+    thresholds = sorted({t for t, _ in cells}, key=row_key)
+    likelihoods = sorted({l for _, l in cells})
+    lo, hi = min(cells.values()), max(cells.values())
+
+    width, height = max(LEFT + CELL_W * len(likelihoods) + 10, 480), TOP + CELL_H * len(thresholds) + 40
+    out = ['<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d" font-family="sans-serif" font-size="11">' % (width, height),
+           '<text x="%d" y="18" font-size="13">median runtime (s) by threshold and percent likelihood same</text>' % LEFT]
+    for col, likelihood in enumerate(likelihoods):
+        out.append('<text x="%d" y="%d" text-anchor="middle">%d%%</text>' % (LEFT + CELL_W * col + CELL_W // 2, TOP - 6, likelihood))
+    for row, threshold in enumerate(thresholds):
+        y = TOP + CELL_H * row
+        out.append('<text x="%d" y="%d" text-anchor="end">%s</text>' % (LEFT - 6, y + CELL_H // 2 + 4, threshold))
+        for col, likelihood in enumerate(likelihoods):
+            if (threshold, likelihood) not in cells:
+                continue
+            seconds = cells[(threshold, likelihood)]
+            x = LEFT + CELL_W * col
+            out.append('<rect x="%d" y="%d" width="%d" height="%d" fill="%s"/>' % (x, y, CELL_W, CELL_H, color((seconds - lo) / (hi - lo) if hi > lo else 0.0)))
+            out.append('<text x="%d" y="%d" text-anchor="middle">%.3f</text>' % (x + CELL_W // 2, y + CELL_H // 2 + 4, seconds))
+    out.append('<text x="%d" y="%d">fastest %.3fs, slowest %.3fs</text>' % (LEFT, height - 12, lo, hi))
+    out.append("</svg>")
+    with open(svg_path, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: plot_sweep.py sweep.csv sweep.svg")
+    main(sys.argv[1], sys.argv[2])
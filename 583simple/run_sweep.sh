@@ -0,0 +1,60 @@
+#!/bin/bash
+### run_sweep.sh
+### runtime of classex over fp_funcoptim's alias threshold x the percent_likelihood_same of its input
+### usage: ./run_sweep.sh [output name]
+### e.g., REPEATS=10 THRESHOLDS="0.5 0.8" ./run_sweep.sh classex_sweep
+### writes ${OUT}.csv (median/min/max seconds of REPEATS runs per cell) and the ${OUT}.svg heatmap of the medians
+### the "model" row is the cost model instead of a threshold, the "none" row the unoptimized program
+
+PATH_PROFILE=~/eecs583fp/build/PROFILE/PROFILE.so ### Action Required: Specify the path to the profile pass ###
+PATH_MYPASS=~/eecs583fp/build/OPTIM/OPTIM.so ### Action Required: Specify the path to your pass ###
+PATH_ALIASPROF=~/eecs583fp/build/ALIASPROF/fp-aliasprof
+NAME_MYPASS=-fp_funcoptim
+NAME_THRESHOLD=-fp-funcoptim-threshold
+BENCH_NAME=classex
+BENCH=src/${BENCH_NAME}.c
+OUT=${1:-${BENCH_NAME}_sweep}
+
+THRESHOLDS=${THRESHOLDS:-"0.0 0.1 0.2 0.3 0.4 0.5 0.6 0.7 0.8 0.9 1.0"}
+LIKELIHOODS=${LIKELIHOODS:-"0 10 20 30 40 50 60 70 80 90 100"}
+REPEATS=${REPEATS:-5}
+LOOP_COUNT=${LOOP_COUNT:-1000000}
+PROFILE_LOOP_COUNT=${PROFILE_LOOP_COUNT:-10000}
+
+set -e
+
+# same indices, so percent_likelihood_same is how often the 2 fn_PURE_ calls get the same arg
+input() { echo "1 , 1 , ${1} , ${2} , 0"; }
+
+# median, min and max of REPEATS runs of ./${1}
+time_runs() {
+  local times=()
+  TIMEFORMAT=%R
+  for ((run = 0; run < REPEATS; ++run)); do
+    times+=($( { time ./${1} "${2}" > /dev/null; } 2>&1 ))
+  done
+  printf "%s\n" "${times[@]}" | sort -g | awk '{ t[NR] = $1 } END { printf "%s,%s,%s", t[int((NR + 1) / 2)], t[1], t[NR] }'
+}
+
+clang -emit-llvm -c ${BENCH} -o ${BENCH_NAME}.bc
+opt -enable-new-pm=0 -load ${PATH_PROFILE} -fp_profile < ${BENCH_NAME}.bc > ${BENCH_NAME}.prof.bc
+clang -lm ${BENCH_NAME}.prof.bc -o ${BENCH_NAME}.prof # need -lm for sqrt()
+clang -lm ${BENCH_NAME}.bc -o ${BENCH_NAME}.sweep.none
+
+echo "threshold,likelihood,median_s,min_s,max_s" > ${OUT}.csv
+for LIKELIHOOD in ${LIKELIHOODS}; do
+  echo "RUNSWEEP: profiling with percent likelihood ${LIKELIHOOD}..."
+  ./${BENCH_NAME}.prof "$(input ${PROFILE_LOOP_COUNT} ${LIKELIHOOD})" > /dev/null
+  ${PATH_ALIASPROF} convert ${BENCH_NAME}.bc log.log -o ${BENCH_NAME}.sweep.aliasprof
+
+  echo "none,${LIKELIHOOD},$(time_runs ${BENCH_NAME}.sweep.none "$(input ${LOOP_COUNT} ${LIKELIHOOD})")" >> ${OUT}.csv
+  for THRESHOLD in model ${THRESHOLDS}; do
+    if [ ${THRESHOLD} = model ]; then FLAGS=-fp-cost-model=true; else FLAGS="-fp-cost-model=false ${NAME_THRESHOLD}=${THRESHOLD}"; fi
+    opt -enable-new-pm=0 -load ${PATH_MYPASS} ${NAME_MYPASS} ${FLAGS} -fp-profile=${BENCH_NAME}.sweep.aliasprof < ${BENCH_NAME}.bc > ${BENCH_NAME}.sweep.bc
+    clang -lm ${BENCH_NAME}.sweep.bc -o ${BENCH_NAME}.sweep
+    echo "${THRESHOLD},${LIKELIHOOD},$(time_runs ${BENCH_NAME}.sweep "$(input ${LOOP_COUNT} ${LIKELIHOOD})")" | tee -a ${OUT}.csv
+  done
+done
+
+python3 plot_sweep.py ${OUT}.csv ${OUT}.svg
+echo "RUNSWEEP: wrote ${OUT}.csv and ${OUT}.svg"
@@ -54,7 +54,6 @@ int main(int argc, char* argv[]) {
 }
 
 /*
-TODO
-idea to show: 2D grah of evolution runtime by changing optimpass threshold and
-percent_likelihood_same used in GetRandIdxSometimes() here
+2D graph of the runtime by optimpass threshold and percent_likelihood_same used in
+GetRandIdxSometimes() here: see ../run_sweep.sh
 */
@@ -0,0 +1,421 @@
+/*
+fp-aliasprof: build, merge and inspect .aliasprof alias profiles, a la llvm-profdata.
+
+  fp-aliasprof convert prog.bc log.log -o prog.aliasprof     replay a trace of the instrumented prog.bc
+  fp-aliasprof merge a.aliasprof -weighted-input=3,b.aliasprof -o merged.aliasprof
+  fp-aliasprof show merged.aliasprof
+  fp-aliasprof report prog.bc merged.aliasprof -top=20 [-json]   hot pairs with their source locations
+
+prog.bc is the module before the profile pass, the one given to fp_analysis. The optimization passes then
+load the profile with -fp-profile=prog.aliasprof instead of replaying the trace.
+*/
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../ANALYSIS/aliasProfile.hpp"
+
+using namespace llvm;
+using namespace fp583;
+
+static int exitWithError(const Twine& message) {
+  WithColor::error(errs(), "fp-aliasprof") << message << '\n';
+  return 1;
+}
+
+// same analyses fp_analysis gets from the legacy pass manager
+static ProfileIds getModuleProfileIds(Module& m, bool allPairs) {
+  std::map<Function*, std::unique_ptr<DominatorTree>> funcToDomTree;
+  std::map<Function*, std::unique_ptr<LoopInfo>> funcToLoopInfo;
+  return getProfileIds(m, [&](Function& f) -> LoopInfo& {
+    auto& loopInfo = funcToLoopInfo[&f];
+    if (!loopInfo) {
+      funcToDomTree[&f] = std::make_unique<DominatorTree>(f);
+      loopInfo = std::make_unique<LoopInfo>(*funcToDomTree[&f]);
+    }
+    return *loopInfo;
+  }, allPairs);
+}
+
+static int convertMain(int argc, const char* argv[]) {
+  cl::opt<std::string> ModulePath(cl::Positional, cl::Required, cl::desc("<module.bc>"));
+  cl::opt<std::string> TracePath(cl::Positional, cl::Required, cl::desc("<trace>"));
+  cl::opt<std::string> OutputPath("o", cl::Required, cl::desc("Output .aliasprof"));
+  cl::opt<unsigned> NumThreads("j", cl::init(std::thread::hardware_concurrency()),
+    cl::desc("Number of threads used to replay the trace"));
+  cl::opt<bool> AllPairs("all-pairs", cl::desc("Compare every pair of locations, not only the ones an optimization could ask about"));
+  cl::opt<unsigned> SketchMemory("sketch-memory", cl::init(0),
+    cl::desc("Replay in approximate mode, with this many MiB of count-min sketches for the pair counts, loop stats stay exact (0 for exact counts)"));
+  cl::opt<unsigned> PhaseWindow("phase-window", cl::init(0),
+    cl::desc("Split the run in phases, comparing windows of this many MiB of trace (0 for a single phase)"));
+  cl::opt<double> PhaseSimilarity("phase-similarity", cl::init(0.5),
+    cl::desc("Windows less alike than this to every phase so far start a new phase"));
+  cl::opt<unsigned> MaxPhases("max-phases", cl::init(8), cl::desc("Maximum number of phases"));
+  cl::ParseCommandLineOptions(argc, argv, "fp-aliasprof convert\n");
+
+  LLVMContext context;
+  SMDiagnostic diag;
+  std::unique_ptr<Module> m = parseIRFile(ModulePath, diag, context);
+  if (!m) {
+    diag.print(argv[0], errs());
+    return 1;
+  }
+
+  ProfileIds profileIds = getModuleProfileIds(*m, AllPairs);
+  PhaseDetection phaseDetection;
+  phaseDetection.windowSize = (uint64_t)PhaseWindow << 20;
+  phaseDetection.minSimilarity = PhaseSimilarity;
+  phaseDetection.maxPhases = MaxPhases;
+  AliasProfile profile;
+  std::string error;
+  if (!replayTraceToProfile(profile, profileIds, TracePath, NumThreads, (size_t)SketchMemory << 20, phaseDetection, error)) {
+    return exitWithError(error);
+  }
+  if (!writeAliasProfile(profile, OutputPath, error)) return exitWithError(error);
+  return 0;
+}
+
+static int mergeMain(int argc, const char* argv[]) {
+  cl::list<std::string> InputPaths(cl::Positional, cl::desc("<profile...>"));
+  cl::list<std::string> WeightedInputs("weighted-input", cl::desc("<weight>,<profile>, counts are multiplied by weight"));
+  cl::opt<std::string> OutputPath("o", cl::Required, cl::desc("Output .aliasprof"));
+  cl::ParseCommandLineOptions(argc, argv, "fp-aliasprof merge\n");
+
+  std::vector<std::pair<std::string, uint32_t>> inputs;
+  for (auto& inputPath : InputPaths) inputs.emplace_back(inputPath, 1);
+  for (StringRef weightedInput : WeightedInputs) {
+    auto [weightStr, inputPath] = weightedInput.split(',');
+    uint32_t weight;
+    if (inputPath.empty() || weightStr.getAsInteger(10, weight) || weight == 0) {
+      return exitWithError("malformed -weighted-input=" + weightedInput);
+    }
+    inputs.emplace_back(inputPath.str(), weight);
+  }
+  if (inputs.empty()) return exitWithError("no input profiles");
+
+  AliasProfile merged;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    auto& [inputPath, weight] = inputs[i];
+    AliasProfile profile;
+    std::string error;
+    if (!readAliasProfile(profile, inputPath, error)) return exitWithError(error);
+    if (i == 0) {
+      merged.moduleHash = profile.moduleHash;
+      merged.numIds = profile.numIds;
+      merged.numLoops = profile.numLoops;
+      merged.pairToAliasStats = PairMatrix<AliasStats>(profile.numIds);
+    }
+    else if (profile.moduleHash != merged.moduleHash) {
+      return exitWithError(inputPath + " was made for another module than " + inputs[0].first);
+    }
+    merged.mergeWeighted(profile, weight);
+  }
+
+  std::string error;
+  if (!writeAliasProfile(merged, OutputPath, error)) return exitWithError(error);
+  return 0;
+}
+
+static int showMain(int argc, const char* argv[]) {
+  cl::opt<std::string> InputPath(cl::Positional, cl::Required, cl::desc("<profile>"));
+  cl::opt<bool> ShowPairs("all-pairs", cl::desc("Print the stats of every pair"));
+  cl::ParseCommandLineOptions(argc, argv, "fp-aliasprof show\n");
+
+  AliasProfile profile;
+  std::string error;
+  if (!readAliasProfile(profile, InputPath, error)) return exitWithError(error);
+
+  size_t numPairs = 0, numAliasingPairs = 0, numLoopPairs = 0;
+  profile.pairToAliasStats.forEach([&](size_t id_a, size_t id_b, const AliasStats& aliasStats) {
+    if (aliasStats.num_comparisons == 0) return;
+    numPairs++;
+    numAliasingPairs += aliasStats.num_collisions > 0;
+    if (ShowPairs) {
+      AliasEstimate estimate(aliasStats.num_collisions, aliasStats.num_comparisons, 0, 1.96,
+                             profile.aliasStatsError.num_collisions, profile.aliasStatsError.num_comparisons);
+      outs() << "pair " << id_a << ' ' << id_b << ": " << aliasStats.num_collisions << '/' << aliasStats.num_comparisons
+             << format(" (95%% CI %.4f-%.4f)", estimate.lower, estimate.upper) << '\n';
+    }
+  });
+  for (auto& [loopId, pairToLoopAliasStats] : profile.loopIdToLoopAliasStats) numLoopPairs += pairToLoopAliasStats.size();
+
+  outs() << "Module hash: " << format_hex(profile.moduleHash, 18) << '\n'
+         << "Locations: " << profile.numIds << '\n'
+         << "Loops: " << profile.numLoops - 1 << '\n'
+         << "Compared pairs: " << numPairs << '\n'
+         << "Aliasing pairs: " << numAliasingPairs << '\n'
+         << "Loop pairs: " << numLoopPairs << '\n'
+         << "Phases: " << std::max<size_t>(1, profile.phases.size()) << '\n';
+  if (profile.aliasStatsError.num_comparisons) {
+    outs() << "Approximate, counts may be over by up to " << profile.aliasStatsError.num_collisions << " collisions and "
+           << profile.aliasStatsError.num_comparisons << " comparisons\n";
+  }
+  return 0;
+}
+
+// "file:line:col in func" for the first access to every location, "func: ptr" when there is no debug info
+static std::vector<std::string> getIdToSourceLocation(Module& m, const std::unordered_map<MemoryLocation, size_t>& memLocToId) {
+  std::vector<std::string> ret(memLocToId.size());
+  std::vector<bool> hasDebugLoc(memLocToId.size(), false);
+  for (auto& func : m) {
+    for (auto& bb : func) {
+      for (auto& inst : bb) {
+        auto memLocOpt = MemoryLocation::getOrNone(&inst);
+        if (!memLocOpt.hasValue()) continue;
+        size_t id = memLocToId.at(memLocOpt.getValue());
+        const DebugLoc& debugLoc = inst.getDebugLoc();
+        if (hasDebugLoc[id] || (!ret[id].empty() && !debugLoc)) continue;
+
+        raw_string_ostream os(ret[id]);
+        ret[id].clear();
+        if (debugLoc) {
+          os << debugLoc->getFilename() << ':' << debugLoc.getLine() << ':' << debugLoc.getCol() << " in " << func.getName();
+          hasDebugLoc[id] = true;
+        }
+        else {
+          os << func.getName() << ": ";
+          memLocOpt->Ptr->printAsOperand(os, false, &m);
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+/* Pairs whose alias frequency falls in [i / 10, (i + 1) / 10), except 0 and 1 which get their own bucket:
+   those are the ones speculation is worth it for */
+struct FrequencyHistogram {
+  static constexpr size_t kNumBuckets = 12;
+  uint64_t bucketToCount[kNumBuckets] = {};
+
+  void add(double frequency) {
+    size_t bucket = frequency <= 0.0 ? 0 : frequency >= 1.0 ? kNumBuckets - 1 : 1 + (size_t)(frequency * 10);
+    bucketToCount[bucket]++;
+  }
+
+  static std::string getBucketName(size_t bucket) {
+    if (bucket == 0) return "never";
+    if (bucket == kNumBuckets - 1) return "always";
+    return std::to_string((bucket - 1) * 10) + "-" + std::to_string(bucket * 10) + "%";
+  }
+
+  void print(raw_ostream& os, const Twine& title) const {
+    os << title << ":\n";
+    uint64_t maxCount = std::max<uint64_t>(1, *std::max_element(std::begin(bucketToCount), std::end(bucketToCount)));
+    for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+      os << format("  %-8s %10llu", getBucketName(bucket).c_str(), (unsigned long long)bucketToCount[bucket]);
+      if (bucketToCount[bucket]) os << ' ' << std::string(std::max<uint64_t>(1, bucketToCount[bucket] * 50 / maxCount), '#');
+      os << '\n';
+    }
+  }
+
+  void writeJSON(json::OStream& json) const {
+    json.array([&] {
+      for (size_t bucket = 0; bucket < kNumBuckets; ++bucket) {
+        json.object([&] {
+          json.attribute("bucket", getBucketName(bucket));
+          json.attribute("pairs", (int64_t)bucketToCount[bucket]);
+        });
+      }
+    });
+  }
+};
+
+struct ReportPair {
+  size_t id_a = 0, id_b = 0;
+  AliasStats aliasStats = {};
+  AliasEstimate estimate = {};
+  std::vector<AliasEstimate> phaseEstimates = {};
+  bool isPhaseDependent = false; // known in 2 phases with disjoint intervals
+};
+
+static int reportMain(int argc, const char* argv[]) {
+  cl::opt<std::string> ModulePath(cl::Positional, cl::Required, cl::desc("<module.bc>"));
+  cl::opt<std::string> InputPath(cl::Positional, cl::Required, cl::desc("<profile>"));
+  cl::opt<unsigned> NumTop("top", cl::init(20), cl::desc("Number of pairs listed by collisions and by comparisons"));
+  cl::opt<unsigned> MinSamples("min-samples", cl::init(32), cl::desc("Pairs compared fewer times are reported as unknown"));
+  cl::opt<bool> JSON("json", cl::desc("Print the report as JSON"));
+  cl::opt<std::string> OutputPath("o", cl::init("-"), cl::desc("Output file"));
+  cl::ParseCommandLineOptions(argc, argv, "fp-aliasprof report\n");
+
+  LLVMContext context;
+  SMDiagnostic diag;
+  std::unique_ptr<Module> m = parseIRFile(ModulePath, diag, context);
+  if (!m) {
+    diag.print(argv[0], errs());
+    return 1;
+  }
+  AliasProfile profile;
+  std::string error;
+  if (!readAliasProfile(profile, InputPath, error)) return exitWithError(error);
+  ProfileIds profileIds = getModuleProfileIds(*m, false);
+  if (profile.moduleHash != profileIds.moduleHash) return exitWithError(InputPath + " was made for another module than " + ModulePath);
+  std::vector<std::string> idToSourceLocation = getIdToSourceLocation(*m, profileIds.memLocToId);
+
+  std::vector<ReportPair> pairs;
+  FrequencyHistogram pairHistogram, iterationHistogram;
+  uint64_t numUnknownPairs = 0;
+  profile.pairToAliasStats.forEach([&](size_t id_a, size_t id_b, const AliasStats& aliasStats) {
+    if (aliasStats.num_comparisons == 0) return;
+    AliasEstimate estimate(aliasStats.num_collisions, aliasStats.num_comparisons, MinSamples, 1.96,
+                           profile.aliasStatsError.num_collisions, profile.aliasStatsError.num_comparisons);
+    if (estimate.known) pairHistogram.add(estimate.probability);
+    else numUnknownPairs++;
+    ReportPair pair = {id_a, id_b, aliasStats, estimate};
+    for (auto& phase : profile.phases) {
+      const AliasStats* phaseStats = phase.pairToAliasStats.find(id_a, id_b);
+      pair.phaseEstimates.push_back(!phaseStats ? AliasEstimate() : AliasEstimate(phaseStats->num_collisions,
+        phaseStats->num_comparisons, MinSamples, 1.96, phase.aliasStatsError.num_collisions, phase.aliasStatsError.num_comparisons));
+    }
+    for (auto& lhs : pair.phaseEstimates) {
+      for (auto& rhs : pair.phaseEstimates) pair.isPhaseDependent |= lhs.known && rhs.known && lhs.upper < rhs.lower;
+    }
+    pairs.push_back(pair);
+  });
+  for (auto& [loopId, pairToLoopAliasStats] : profile.loopIdToLoopAliasStats) {
+    for (auto& [pairKey, loopAliasStats] : pairToLoopAliasStats) {
+      if (loopAliasStats.num_iterations >= std::max(1u, (unsigned)MinSamples)) {
+        iterationHistogram.add(loopAliasStats.getIterationAliasFrequency());
+      }
+    }
+  }
+
+  // pairs for which the key is 0 aren't listed
+  auto getTopPairs = [&](auto getKey) {
+    std::vector<ReportPair> ret;
+    std::copy_if(pairs.begin(), pairs.end(), std::back_inserter(ret), [&](const ReportPair& pair) { return getKey(pair) > 0; });
+    size_t numTop = std::min<size_t>(NumTop, ret.size());
+    std::partial_sort(ret.begin(), ret.begin() + numTop, ret.end(), [&](const ReportPair& lhs, const ReportPair& rhs) {
+      return getKey(lhs) > getKey(rhs);
+    });
+    ret.resize(numTop);
+    return ret;
+  };
+  auto topByCollisions = getTopPairs([](const ReportPair& pair) { return pair.aliasStats.num_collisions; });
+  auto topByComparisons = getTopPairs([](const ReportPair& pair) { return pair.aliasStats.num_comparisons; });
+  auto topPhaseDependent = getTopPairs([](const ReportPair& pair) { return pair.isPhaseDependent ? pair.aliasStats.num_comparisons : 0; });
+
+  std::error_code ec;
+  raw_fd_ostream os(OutputPath, ec);
+  if (ec) return exitWithError("could not write " + OutputPath + ": " + ec.message());
+
+  if (JSON) {
+    json::OStream json(os, 2);
+    auto writeEstimate = [&](const AliasEstimate& estimate) {
+      json.attribute("known", estimate.known);
+      json.attribute("probability", estimate.probability);
+      json.attribute("lower", estimate.lower);
+      json.attribute("upper", estimate.upper);
+    };
+    auto writePairs = [&](const std::vector<ReportPair>& topPairs) {
+      json.array([&] {
+        for (auto& pair : topPairs) {
+          json.object([&] {
+            json.attribute("id_a", (int64_t)pair.id_a);
+            json.attribute("id_b", (int64_t)pair.id_b);
+            json.attribute("location_a", idToSourceLocation[pair.id_a]);
+            json.attribute("location_b", idToSourceLocation[pair.id_b]);
+            json.attribute("collisions", (int64_t)pair.aliasStats.num_collisions);
+            json.attribute("comparisons", (int64_t)pair.aliasStats.num_comparisons);
+            writeEstimate(pair.estimate);
+            if (pair.phaseEstimates.empty()) return;
+            json.attributeArray("phases", [&] {
+              for (auto& phaseEstimate : pair.phaseEstimates) json.object([&] { writeEstimate(phaseEstimate); });
+            });
+          });
+        }
+      });
+    };
+    json.object([&] {
+      json.attribute("module_hash", utohexstr(profile.moduleHash));
+      json.attribute("locations", (int64_t)profile.numIds);
+      json.attribute("compared_pairs", (int64_t)pairs.size());
+      json.attribute("unknown_pairs", (int64_t)numUnknownPairs);
+      json.attribute("collisions_error", (int64_t)profile.aliasStatsError.num_collisions);
+      json.attribute("comparisons_error", (int64_t)profile.aliasStatsError.num_comparisons);
+      json.attribute("phases", (int64_t)std::max<size_t>(1, profile.phases.size()));
+      json.attributeBegin("top_by_collisions");
+      writePairs(topByCollisions);
+      json.attributeEnd();
+      json.attributeBegin("top_by_comparisons");
+      writePairs(topByComparisons);
+      json.attributeEnd();
+      json.attributeBegin("top_phase_dependent");
+      writePairs(topPhaseDependent);
+      json.attributeEnd();
+      json.attributeBegin("pair_histogram");
+      pairHistogram.writeJSON(json);
+      json.attributeEnd();
+      json.attributeBegin("loop_iteration_histogram");
+      iterationHistogram.writeJSON(json);
+      json.attributeEnd();
+    });
+    os << '\n';
+    return 0;
+  }
+
+  auto printEstimate = [&](const AliasEstimate& estimate) {
+    if (estimate.known) os << format("%6.2f%% [%.4f-%.4f]", 100 * estimate.probability, estimate.lower, estimate.upper);
+    else os << "   unknown";
+  };
+  auto printPairs = [&](const std::vector<ReportPair>& topPairs, const Twine& title, bool printPhases) {
+    os << title << ":\n";
+    for (auto& pair : topPairs) {
+      os << format("  %10u / %-10u ", pair.aliasStats.num_collisions, pair.aliasStats.num_comparisons);
+      printEstimate(pair.estimate);
+      os << "\n      " << idToSourceLocation[pair.id_a] << "\n      " << idToSourceLocation[pair.id_b] << '\n';
+      for (size_t phase = 0; printPhases && phase < pair.phaseEstimates.size(); ++phase) {
+        os << format("      phase %-3zu ", phase);
+        printEstimate(pair.phaseEstimates[phase]);
+        os << '\n';
+      }
+    }
+    os << '\n';
+  };
+  printPairs(topByCollisions, "Top " + Twine(topByCollisions.size()) + " pairs by collisions", false);
+  printPairs(topByComparisons, "Top " + Twine(topByComparisons.size()) + " pairs by comparisons", false);
+  if (!profile.phases.empty()) {
+    printPairs(topPhaseDependent, "Top " + Twine(topPhaseDependent.size()) + " pairs aliasing differently across the "
+                                  + Twine(profile.phases.size()) + " phases", true);
+  }
+  pairHistogram.print(os, "Alias frequency of the pairs compared at least " + Twine((unsigned)MinSamples) + " times ("
+                          + Twine(numUnknownPairs) + " compared less)");
+  iterationHistogram.print(os, "Fraction of the iterations in which loop pairs alias");
+  return 0;
+}
+
+int main(int argc, const char* argv[]) {
+  InitLLVM X(argc, argv);
+  StringRef command = argc > 1 ? argv[1] : "";
+  auto* commandMain = command == "convert" ? convertMain
+                    : command == "merge" ? mergeMain
+                    : command == "show" ? showMain
+                    : command == "report" ? reportMain : nullptr;
+  if (!commandMain) {
+    errs() << "usage: " << argv[0] << " convert|merge|show|report [args...]\n";
+    return 1;
+  }
+
+  // argv[0] becomes "fp-aliasprof <command>" for the usage messages
+  std::string programName = std::string(argv[0]) + ' ' + argv[1];
+  argv[1] = programName.c_str();
+  return commandMain(argc - 1, argv + 1);
+}
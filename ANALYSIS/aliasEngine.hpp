@@ -0,0 +1,523 @@
+#ifndef _ALIAS_ENGINE_H_
+#define _ALIAS_ENGINE_H_
+
+#include <algorithm>
+#include <tuple>
+#include <vector>
+#include <unordered_map>
+
+#include "../PROFILE/helpers.hpp"
+#include "aliasStats.hpp"
+#include "countMinSketch.hpp"
+#include "pairMatrix.hpp"
+
+namespace fp583 {
+
+/*
+Pairs of ids an optimization could ask about, only those are compared. Ids are grouped in scopes (e.g. all the
+locations accessed by a function) and 2 ids are candidates when they share a scope. Only the scopes are kept,
+never the pairs themselves, so a scope of k ids costs k and not k^2 (-fp-all-pairs is a single scope of everything)
+*/
+struct CandidatePairs {
+  std::vector<std::vector<size_t>> idToScopes; // in increasing order
+  std::vector<std::vector<size_t>> scopeToIds;
+  size_t numScopes = 0;
+
+  explicit CandidatePairs(size_t numIds = 0) : idToScopes(numIds) {}
+
+  void addScope(const std::vector<size_t>& ids) {
+    size_t scope = numScopes++;
+    scopeToIds.push_back(ids);
+    for (size_t id : ids) idToScopes[id].push_back(scope);
+  }
+
+  // first scope shared by the 2 ids, numScopes if none
+  size_t getFirstSharedScope(size_t id_a, size_t id_b) const {
+    auto& scopes_a = idToScopes[id_a];
+    auto& scopes_b = idToScopes[id_b];
+    for (size_t i = 0, j = 0; i < scopes_a.size() && j < scopes_b.size();) {
+      if (scopes_a[i] == scopes_b[j]) return scopes_a[i];
+      if (scopes_a[i] < scopes_b[j]) ++i;
+      else ++j;
+    }
+    return numScopes;
+  }
+
+  bool contains(size_t id_a, size_t id_b) const {
+    return id_a < idToScopes.size() && id_b < idToScopes.size() && getFirstSharedScope(id_a, id_b) < numScopes;
+  }
+
+  /* Call action(id_a, id_b) with id_a < id_b once for every candidate pair, from the first scope it's in */
+  template <typename ACTION_T>
+  void forEach(ACTION_T&& action) const {
+    for (size_t scope = 0; scope < numScopes; ++scope) {
+      auto& ids = scopeToIds[scope];
+      for (size_t i = 0; i < ids.size(); ++i) {
+        for (size_t j = i + 1; j < ids.size(); ++j) {
+          if (ids[i] == ids[j] || getFirstSharedScope(ids[i], ids[j]) != scope) continue;
+          action(std::min(ids[i], ids[j]), std::max(ids[i], ids[j]));
+        }
+      }
+    }
+  }
+};
+
+/* Everything the replay needs to know about the ids of the trace, computed from the module */
+struct ReplayIds {
+  LoopIds loopIds;
+  std::vector<size_t> idToLoopId; // innermost loop in which the location's pointer is defined
+  std::vector<size_t> idToPtrClass; // ids of locations sharing the same pointer are never compared
+  std::vector<std::vector<size_t>> frameIdToIds; // stack locations of every frame (see getFrameIds)
+  CandidatePairs candidatePairs;
+
+  // false for a record the module can't have written: an id, loop or frame it doesn't have
+  bool isValidRecord(size_t id, uint64_t payload) const {
+    if (id == FP_TRACE_FRAME_EXIT_ID) return payload < frameIdToIds.size();
+    if (id >= FP_TRACE_FIRST_MARKER_ID) return payload < loopIds.parentId.size();
+    return id < idToLoopId.size();
+  }
+};
+
+/*
+Replays the trace and accumulates alias stats for every pair of location ids.
+
+Instead of comparing each event against the shadow value of every id, current addresses are indexed to the
+ids holding them so collisions are a single lookup. Comparisons don't need to be looked at one by one either:
+while both ids of a pair hold a live address, every event of either id is a comparison, so the comparisons of
+one such overlap are
+  (num_events(a) + num_events(b) when it ends) - (num_events(a) + num_events(b) when it starts)
+and pairs only need to be touched when an id becomes live (first event, or first event after its frame died)
+or dies (its frame returns).
+
+Loop stats work the same way for pairs where one id is defined outside the other's loop. Pairs defined in the
+same loop depend on the iteration each value comes from, so they are compared explicitly against the other
+ids of the loop (a loop body is small, unlike the whole program).
+
+Only pairs in candidatePairs are tracked at all.
+
+The per pair counters grow with the number of pairs ever live together, which for huge programs doesn't fit in
+memory. The approximate mode (sketchWidth > 0) keeps collisions, comparisons and iterations of pairs in
+fixed size count-min sketches instead: an overlap subtracts the counts it starts at and adds the ones it ends at,
+so every pair ends up with a non negative count and estimates are bounded (see CountMinSketch). Pairs whose
+count can't be told apart from the error are dropped from the stats, and since engines of the parallel replay
+start their live pairs explicitly, merging them is just adding sketches.
+Loop stats are still kept exactly, as they grow with the size of loop bodies and with the pairs which collide in
+a loop rather than with every pair ever live together.
+*/
+struct AliasEngine {
+  struct ShadowValue {
+    uint64_t addr = 0;
+    uint64_t iteration_stamp = 0; // iteration of the id's loop in which addr was observed
+    bool valid = false; // false until the first event, and once the frame holding addr returned
+  };
+
+  // Stamps identify iterations uniquely across all loops and invocations
+  struct LoopState {
+    uint64_t iteration_stamp = 0;
+    uint64_t invocation_first_stamp = 0;
+  };
+
+  // Everything about the replay at a given point of the trace which isn't an alias stat
+  struct ReplayState {
+    std::vector<ShadowValue> idToShadowValue;
+    std::vector<uint64_t> idToNumEvents;
+    std::vector<uint64_t> idToNumIterations; // iterations of the id's loop in which it was observed
+    std::vector<LoopState> loopStates;
+    uint64_t stampClock = 0;
+
+    ReplayState(size_t numIds, size_t numLoops)
+      : idToShadowValue(numIds), idToNumEvents(numIds, 0), idToNumIterations(numIds, 0), loopStates(numLoops) {}
+  };
+
+  enum class Overlap : uint8_t {
+    FromStart, // live since the start of this engine's part of the trace, if both ids are live at all
+    Started,   // started in this part, at the recorded counts
+    Ended      // ended in this part and not started again
+  };
+
+  struct PairCounters {
+    uint64_t num_collisions = 0;
+    uint64_t num_comparisons = 0; // of the overlaps which ended
+    uint64_t num_iterations = 0; // (inner id, id defined outside its loop) pairs, of the overlaps which ended
+    uint64_t comparisons_start = 0, iterations_start = 0;
+    Overlap overlap = Overlap::FromStart;
+  };
+
+  struct PairSketches {
+    CountMinSketch collisions, comparisons, iterations; // keyed by getIdPairKey
+
+    explicit PairSketches(size_t width = 0) : collisions(width), comparisons(width), iterations(width) {}
+
+    void merge(const PairSketches& other) {
+      collisions.merge(other.collisions);
+      comparisons.merge(other.comparisons);
+      iterations.merge(other.iterations);
+    }
+  };
+
+  const std::vector<size_t>& idToLoopId;
+  const std::vector<size_t>& idToPtrClass;
+  const LoopIds& loopIds;
+  const CandidatePairs& candidatePairs;
+  const std::vector<std::vector<size_t>>& frameIdToIds;
+
+  ReplayState state;
+  std::vector<uint64_t> initialNumEvents, initialNumIterations;
+  std::unordered_map<uint64_t, std::vector<size_t>> addrToIds;
+  std::vector<std::vector<size_t>> scopeToLiveIds;
+  std::vector<std::vector<size_t>> loopIdToIds;
+
+  PairMatrix<PairCounters> pairToCounters; // empty in approximate mode
+  PairSketches pairSketches; // only in approximate mode
+  std::unordered_map<size_t, std::unordered_map<uint64_t, LoopAliasStats>> loopIdToLoopAliasStats;
+
+  // see forEachLivePartner
+  mutable std::vector<uint64_t> idToVisitMark;
+  mutable uint64_t visitMark = 0;
+
+  explicit AliasEngine(const ReplayIds& ids, size_t sketchWidth = 0)
+    : AliasEngine(ids, ReplayState(ids.idToLoopId.size(), ids.loopIds.parentId.size()), sketchWidth) {}
+
+  /* Resume the replay from the middle of the trace, initialState must be the state right before the first
+     event given to this engine. Only the stats accumulated from there are recorded */
+  AliasEngine(const ReplayIds& ids, ReplayState initialState, size_t sketchWidth = 0)
+    : idToLoopId(ids.idToLoopId), idToPtrClass(ids.idToPtrClass), loopIds(ids.loopIds), candidatePairs(ids.candidatePairs),
+      frameIdToIds(ids.frameIdToIds), state(std::move(initialState)), initialNumEvents(state.idToNumEvents),
+      initialNumIterations(state.idToNumIterations), scopeToLiveIds(candidatePairs.numScopes),
+      loopIdToIds(loopIds.parentId.size()), pairToCounters(sketchWidth ? 0 : idToLoopId.size()),
+      pairSketches(sketchWidth), idToVisitMark(idToLoopId.size(), 0) {
+    for (size_t id = 0; id < idToLoopId.size(); ++id) {
+      if (idToLoopId[id] != 0) loopIdToIds[idToLoopId[id]].push_back(id);
+      if (state.idToShadowValue[id].valid) {
+        addrToIds[state.idToShadowValue[id].addr].push_back(id);
+        for (size_t scope : candidatePairs.idToScopes[id]) scopeToLiveIds[scope].push_back(id);
+      }
+    }
+    if (isApproximate()) forEachLivePair([&](size_t id_a, size_t id_b) { addOverlapCounts(pairSketches, id_a, id_b, -1); });
+  }
+
+  bool isApproximate() const { return !pairSketches.comparisons.empty(); }
+
+  // true if the value of id_outer holds for a whole iteration of loopId
+  bool isOutsideLoop(size_t id_outer, size_t loopId) const {
+    return loopIds.encloses(idToLoopId[id_outer], loopId);
+  }
+
+  // The id of the pair whose iterations are counted, if one is defined outside the other's loop
+  bool getInnerId(size_t id_a, size_t id_b, size_t& idInner) const {
+    for (size_t id : {id_a, id_b}) {
+      size_t other = id == id_a ? id_b : id_a;
+      if (idToLoopId[id] != 0 && isOutsideLoop(other, idToLoopId[id])) {
+        idInner = id;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool isLive(size_t id) const { return state.idToShadowValue[id].valid; }
+
+  bool isTracked(size_t id_a, size_t id_b) const {
+    return idToPtrClass[id_a] != idToPtrClass[id_b] && candidatePairs.contains(id_a, id_b);
+  }
+
+  // counts at which an overlap which is still going on started
+  std::pair<uint64_t, uint64_t> getOverlapStart(const PairCounters* counters, size_t id_a, size_t id_b) const {
+    if (counters && counters->overlap == Overlap::Started) return {counters->comparisons_start, counters->iterations_start};
+    size_t idInner;
+    return {initialNumEvents[id_a] + initialNumEvents[id_b], getInnerId(id_a, id_b, idInner) ? initialNumIterations[idInner] : 0};
+  }
+
+  // comparisons and iterations of the overlap still going on, if any
+  std::pair<uint64_t, uint64_t> getOpenOverlap(const PairCounters* counters, size_t id_a, size_t id_b) const {
+    if (!isLive(id_a) || !isLive(id_b)) return {0, 0};
+    auto [comparisonsStart, iterationsStart] = getOverlapStart(counters, id_a, id_b);
+    size_t idInner;
+    uint64_t numIterations = getInnerId(id_a, id_b, idInner) ? state.idToNumIterations[idInner] - iterationsStart : 0;
+    return {state.idToNumEvents[id_a] + state.idToNumEvents[id_b] - comparisonsStart, numIterations};
+  }
+
+  // action(idLive) once for every live id tracked with id, however many scopes they share
+  template <typename ACTION_T>
+  void forEachLivePartner(size_t id, ACTION_T&& action) const {
+    ++visitMark;
+    for (size_t scope : candidatePairs.idToScopes[id]) {
+      for (size_t idLive : scopeToLiveIds[scope]) {
+        if (idLive == id || idToVisitMark[idLive] == visitMark || idToPtrClass[idLive] == idToPtrClass[id]) continue;
+        idToVisitMark[idLive] = visitMark;
+        action(idLive);
+      }
+    }
+  }
+
+  template <typename ACTION_T>
+  void forEachLivePair(ACTION_T&& action) const {
+    for (size_t id = 0; id < idToLoopId.size(); ++id) {
+      if (!isLive(id)) continue;
+      forEachLivePartner(id, [&](size_t idLive) {
+        if (id < idLive) action(id, idLive);
+      });
+    }
+  }
+
+  // sign is -1 when the overlap of the pair starts and 1 when it ends, the sketches get the difference
+  void addOverlapCounts(PairSketches& sketches, size_t id_a, size_t id_b, int64_t sign) const {
+    uint64_t pairKey = getIdPairKey(id_a, id_b);
+    sketches.comparisons.add(pairKey, sign * (int64_t)(state.idToNumEvents[id_a] + state.idToNumEvents[id_b]));
+    size_t idInner;
+    if (getInnerId(id_a, id_b, idInner)) sketches.iterations.add(pairKey, sign * (int64_t)state.idToNumIterations[idInner]);
+  }
+
+  // approximate mode, ends the overlaps still going on
+  void closeOpenOverlaps(PairSketches& sketches) const {
+    forEachLivePair([&](size_t id_a, size_t id_b) { addOverlapCounts(sketches, id_a, id_b, 1); });
+  }
+
+  void processMarker(size_t markerId, size_t payload) {
+    if (markerId == FP_TRACE_FRAME_EXIT_ID) {
+      for (size_t id : frameIdToIds[payload]) expireId(id);
+      return;
+    }
+    auto& loopState = state.loopStates[payload];
+    if (markerId == FP_TRACE_LOOP_ENTER_ID) loopState.invocation_first_stamp = state.stampClock + 1;
+    else if (markerId == FP_TRACE_LOOP_ITER_ID) loopState.iteration_stamp = ++state.stampClock;
+  }
+
+  // idIn becomes live, before its event is counted. Pairs sharing several scopes are simply started more than once
+  void startOverlaps(size_t idIn) {
+    if (isApproximate()) forEachLivePartner(idIn, [&](size_t idLive) { addOverlapCounts(pairSketches, idIn, idLive, -1); });
+    for (size_t scope : candidatePairs.idToScopes[idIn]) {
+      auto& liveIds = scopeToLiveIds[scope];
+      for (size_t idLive : liveIds) {
+        if (isApproximate()) break;
+        if (idToPtrClass[idLive] == idToPtrClass[idIn]) continue;
+        auto& counters = pairToCounters(idIn, idLive);
+        counters.overlap = Overlap::Started;
+        counters.comparisons_start = state.idToNumEvents[idIn] + state.idToNumEvents[idLive];
+        size_t idInner;
+        if (getInnerId(idIn, idLive, idInner)) counters.iterations_start = state.idToNumIterations[idInner];
+      }
+      liveIds.push_back(idIn);
+    }
+  }
+
+  // the frame holding the address of id returned
+  void expireId(size_t id) {
+    auto& shadow = state.idToShadowValue[id];
+    if (!shadow.valid) return;
+    if (isApproximate()) forEachLivePartner(id, [&](size_t idLive) { addOverlapCounts(pairSketches, id, idLive, 1); });
+
+    auto& oldIds = addrToIds[shadow.addr];
+    *std::find(oldIds.begin(), oldIds.end(), id) = oldIds.back();
+    oldIds.pop_back();
+    if (oldIds.empty()) addrToIds.erase(shadow.addr);
+
+    for (size_t scope : candidatePairs.idToScopes[id]) {
+      auto& liveIds = scopeToLiveIds[scope];
+      *std::find(liveIds.begin(), liveIds.end(), id) = liveIds.back();
+      liveIds.pop_back();
+      for (size_t idLive : liveIds) {
+        if (isApproximate()) break;
+        if (idToPtrClass[idLive] == idToPtrClass[id]) continue;
+        auto& counters = pairToCounters(id, idLive);
+        if (counters.overlap == Overlap::Ended) continue; // already ended through another scope
+        auto [numComparisons, numIterations] = getOpenOverlap(&counters, id, idLive);
+        counters.num_comparisons += numComparisons;
+        counters.num_iterations += numIterations;
+        counters.overlap = Overlap::Ended;
+      }
+    }
+    shadow.valid = false;
+  }
+
+  void processEvent(size_t idIn, uint64_t addrIn) {
+    auto& shadow = state.idToShadowValue[idIn];
+    size_t loopIdIn = idToLoopId[idIn];
+    const auto& loopStateIn = state.loopStates[loopIdIn];
+
+    if (!shadow.valid) {
+      startOverlaps(idIn);
+    }
+    else {
+      auto& oldIds = addrToIds[shadow.addr];
+      *std::find(oldIds.begin(), oldIds.end(), idIn) = oldIds.back();
+      oldIds.pop_back();
+      if (oldIds.empty()) addrToIds.erase(shadow.addr);
+    }
+
+    state.idToNumEvents[idIn]++;
+    if (loopIdIn != 0 && (!shadow.valid || shadow.iteration_stamp != loopStateIn.iteration_stamp)) {
+      state.idToNumIterations[idIn]++;
+    }
+    shadow = {addrIn, loopStateIn.iteration_stamp, true};
+
+    auto& collidingIds = addrToIds[addrIn];
+    for (size_t idCollide : collidingIds) {
+      if (idToPtrClass[idCollide] == idToPtrClass[idIn]) continue; // don't compute aliasing stats with itself
+      if (!candidatePairs.contains(idIn, idCollide)) continue;
+      if (isApproximate()) pairSketches.collisions.add(getIdPairKey(idIn, idCollide), 1);
+      else pairToCounters(idIn, idCollide).num_collisions++;
+
+      if (loopIdIn != 0 && isOutsideLoop(idCollide, loopIdIn)) {
+        auto& loopAliasStats = loopIdToLoopAliasStats[loopIdIn][getIdPairKey(idIn, idCollide)];
+        if (loopAliasStats.last_aliased_iteration != loopStateIn.iteration_stamp) {
+          loopAliasStats.countAliasedIteration(loopStateIn.iteration_stamp);
+        }
+      }
+    }
+    collidingIds.push_back(idIn);
+
+    if (loopIdIn != 0) {
+      processSameLoopIds(idIn, addrIn, loopIdIn, loopStateIn);
+    }
+  }
+
+  // ids of the same loop are in the same function, so always candidates
+  void processSameLoopIds(size_t idIn, uint64_t addrIn, size_t loopIdIn, const LoopState& loopStateIn) {
+    for (size_t idCompare : loopIdToIds[loopIdIn]) {
+      const auto& shadowCompare = state.idToShadowValue[idCompare];
+      if (!shadowCompare.valid || idToPtrClass[idCompare] == idToPtrClass[idIn]) continue;
+
+      bool sameIteration = shadowCompare.iteration_stamp == loopStateIn.iteration_stamp;
+      bool crossIteration = !sameIteration && shadowCompare.iteration_stamp >= loopStateIn.invocation_first_stamp;
+      if (!sameIteration && !crossIteration) continue;
+
+      auto& loopAliasStats = loopIdToLoopAliasStats[loopIdIn][getIdPairKey(idIn, idCompare)];
+      if (crossIteration) {
+        loopAliasStats.num_cross_comparisons++;
+        if (addrIn == shadowCompare.addr) loopAliasStats.num_cross_collisions++;
+        continue;
+      }
+      if (loopAliasStats.last_iteration != loopStateIn.iteration_stamp) {
+        loopAliasStats.countIteration(loopStateIn.iteration_stamp);
+      }
+      if (addrIn == shadowCompare.addr && loopAliasStats.last_aliased_iteration != loopStateIn.iteration_stamp) {
+        loopAliasStats.countAliasedIteration(loopStateIn.iteration_stamp);
+      }
+    }
+  }
+
+  /* Add the stats of the engine which replayed the part of the trace right after this one, after which
+     this engine is in the state at the end of both parts */
+  void mergeFollowing(AliasEngine&& next) {
+    // next started the overlaps going on where it starts, they end here
+    if (isApproximate()) {
+      closeOpenOverlaps(pairSketches);
+      pairSketches.merge(next.pairSketches);
+    }
+
+    // overlaps still going on at the end of this part end here, and the ones going on at the end of the next part
+    // get explicit starts since next.initialNumEvents is about to be forgotten
+    if (!isApproximate()) candidatePairs.forEach([&](size_t id_a, size_t id_b) {
+      if (!isTracked(id_a, id_b)) return;
+      const PairCounters* counters = pairToCounters.find(id_a, id_b);
+      const PairCounters* nextCounters = next.pairToCounters.find(id_a, id_b);
+      bool openHere = isLive(id_a) && isLive(id_b);
+      bool openNext = next.isLive(id_a) && next.isLive(id_b);
+      if (!openHere && !openNext && !nextCounters) return;
+
+      uint64_t numComparisons = 0, numIterations = 0;
+      if (openHere) { // ends with the events counted so far, i.e. where the next part starts
+        auto [comparisonsStart, iterationsStart] = getOverlapStart(counters, id_a, id_b);
+        numComparisons = next.initialNumEvents[id_a] + next.initialNumEvents[id_b] - comparisonsStart;
+        size_t idInner;
+        if (getInnerId(id_a, id_b, idInner)) numIterations = next.initialNumIterations[idInner] - iterationsStart;
+      }
+
+      auto& merged = pairToCounters(id_a, id_b);
+      merged.num_comparisons += numComparisons;
+      merged.num_iterations += numIterations;
+      if (nextCounters) {
+        merged.num_collisions += nextCounters->num_collisions;
+        merged.num_comparisons += nextCounters->num_comparisons;
+        merged.num_iterations += nextCounters->num_iterations;
+      }
+      merged.overlap = openNext ? Overlap::Started : Overlap::Ended;
+      std::tie(merged.comparisons_start, merged.iterations_start) = next.getOverlapStart(nextCounters, id_a, id_b);
+    });
+    for (auto& [loopId, pairToLoopAliasStats] : next.loopIdToLoopAliasStats) {
+      auto& mergedLoopAliasStats = loopIdToLoopAliasStats[loopId];
+      for (auto& [pairKey, loopAliasStats] : pairToLoopAliasStats) mergedLoopAliasStats[pairKey].mergeFollowing(loopAliasStats);
+    }
+    state = std::move(next.state);
+    addrToIds = std::move(next.addrToIds);
+    scopeToLiveIds = std::move(next.scopeToLiveIds);
+  }
+
+  /* Stats of every pair of ids, num_comparisons is 0 for pairs which were never live at the same time */
+  PairMatrix<AliasStats> getAliasStats() const {
+    PairMatrix<AliasStats> pairToAliasStats(idToLoopId.size());
+    if (isApproximate()) {
+      PairSketches sketches = pairSketches;
+      closeOpenOverlaps(sketches);
+      uint64_t comparisonsError = sketches.comparisons.getErrorBound();
+      candidatePairs.forEach([&](size_t id_a, size_t id_b) {
+        if (!isTracked(id_a, id_b)) return;
+        uint64_t pairKey = getIdPairKey(id_a, id_b);
+        uint64_t numComparisons = sketches.comparisons.estimate(pairKey);
+        if (numComparisons <= comparisonsError) return; // might never have been compared
+        auto& pairAliasStats = pairToAliasStats(id_a, id_b);
+        pairAliasStats.num_comparisons = saturateCount(numComparisons);
+        pairAliasStats.num_collisions = saturateCount(std::min(sketches.collisions.estimate(pairKey), numComparisons));
+      });
+      return pairToAliasStats;
+    }
+
+    pairToCounters.forEach([&](size_t id_a, size_t id_b, const PairCounters& counters) {
+      if (!isTracked(id_a, id_b)) return; // rest of a tile
+      uint64_t numComparisons = counters.num_comparisons + getOpenOverlap(&counters, id_a, id_b).first;
+      if (numComparisons == 0) return;
+      auto& pairAliasStats = pairToAliasStats(id_a, id_b);
+      pairAliasStats.num_comparisons = saturateCount(numComparisons);
+      pairAliasStats.num_collisions = saturateCount(counters.num_collisions);
+    });
+    return pairToAliasStats;
+  }
+
+  /* How far getAliasStats can be from the real stats, with probability 1 - e^-CountMinSketch::kDepth */
+  AliasStatsError getAliasStatsError() const {
+    AliasStatsError ret;
+    if (!isApproximate()) return ret;
+    PairSketches sketches = pairSketches;
+    closeOpenOverlaps(sketches);
+    ret.num_collisions = sketches.collisions.getErrorBound();
+    ret.num_comparisons = sketches.comparisons.getErrorBound();
+    return ret;
+  }
+
+  /* Loop stats keyed by loop id then getIdPairKey. Iterations of pairs with an id defined outside the loop
+     are only known at the end, they are filled in here */
+  std::unordered_map<size_t, std::unordered_map<uint64_t, LoopAliasStats>> getLoopAliasStats() const {
+    auto ret = loopIdToLoopAliasStats;
+    if (isApproximate()) {
+      // loop stats carry no error, so the iterations are lower bounds: frequencies are overestimated, and what
+      // could have been compared too few times is unknown
+      PairSketches sketches = pairSketches;
+      closeOpenOverlaps(sketches);
+      uint64_t iterationsError = sketches.iterations.getErrorBound();
+      candidatePairs.forEach([&](size_t id_a, size_t id_b) {
+        size_t idInner;
+        if (!isTracked(id_a, id_b) || !getInnerId(id_a, id_b, idInner)) return;
+        uint64_t pairKey = getIdPairKey(id_a, id_b);
+        uint64_t numIterations = sketches.iterations.estimate(pairKey);
+        numIterations -= std::min(numIterations, iterationsError);
+        auto& pairToLoopAliasStats = ret[idToLoopId[idInner]];
+        auto it = pairToLoopAliasStats.find(pairKey);
+        if (it != pairToLoopAliasStats.end()) numIterations = std::max<uint64_t>(numIterations, it->second.num_aliased_iterations);
+        if (numIterations) pairToLoopAliasStats[pairKey].num_iterations = saturateCount(numIterations);
+      });
+      return ret;
+    }
+
+    pairToCounters.forEach([&](size_t id_a, size_t id_b, const PairCounters& counters) {
+      size_t idInner;
+      if (!isTracked(id_a, id_b) || !getInnerId(id_a, id_b, idInner)) return;
+      uint64_t numIterations = counters.num_iterations + getOpenOverlap(&counters, id_a, id_b).second;
+      if (numIterations) ret[idToLoopId[idInner]][getIdPairKey(id_a, id_b)].num_iterations = saturateCount(numIterations);
+    });
+    return ret;
+  }
+};
+} // end of namespace fp583
+
+#endif /* _ALIAS_ENGINE_H_ */
@@ -0,0 +1,379 @@
+#ifndef _ALIAS_PROFILE_H_
+#define _ALIAS_PROFILE_H_
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/ValueTracking.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "../PROFILE/helpers.hpp"
+#include "aliasStats.hpp"
+#include "pairMatrix.hpp"
+#include "parallelReplay.hpp"
+#include "tracePhases.hpp"
+
+namespace fp583 {
+
+/*
+.aliasprof layout, little endian, written by writeAliasProfile (see fp-aliasprof for converting and merging):
+  FP_ALIAS_PROFILE_MAGIC
+  AliasProfileHeader
+  num_pairs AliasProfilePairRecord's, sorted by (id_a, id_b)
+  num_loop_pairs AliasProfileLoopRecord's, sorted by (loop_id, id_a, id_b)
+  num_phases times the same from AliasProfileHeader on, for the stats of every phase of the run (see TracePhases)
+Pairs are keyed by location ids and loops by loop ids, both only depend on the un-instrumented module,
+module_hash tells whether a profile belongs to a given module. The collision and comparison errors are those
+of a profile replayed in approximate mode (see AliasStatsError), 0 otherwise.
+*/
+#define FP_ALIAS_PROFILE_MAGIC "FPAPROF3"
+
+struct AliasProfileHeader {
+  uint64_t module_hash;
+  uint64_t num_ids;
+  uint64_t num_loops;
+  uint64_t num_pairs;
+  uint64_t num_loop_pairs;
+  uint64_t collisions_error;
+  uint64_t comparisons_error;
+  uint64_t num_phases;
+};
+
+struct AliasProfilePairRecord {
+  uint32_t id_a, id_b;
+  uint32_t num_collisions, num_comparisons;
+};
+
+struct AliasProfileLoopRecord {
+  uint32_t loop_id, id_a, id_b;
+  uint32_t num_iterations, num_aliased_iterations;
+  uint32_t num_cross_comparisons, num_cross_collisions;
+};
+
+struct AliasProfile {
+  uint64_t moduleHash = 0;
+  size_t numIds = 0;
+  size_t numLoops = 0;
+  AliasStatsError aliasStatsError;
+  PairMatrix<AliasStats> pairToAliasStats;
+  std::unordered_map<size_t, std::unordered_map<uint64_t, LoopAliasStats>> loopIdToLoopAliasStats; // keyed by getIdPairKey
+  std::vector<AliasProfile> phases; // empty unless the run was split in several phases
+
+  AliasProfile() {}
+
+  AliasProfile(uint64_t moduleHash, size_t numIds, size_t numLoops)
+    : moduleHash(moduleHash), numIds(numIds), numLoops(numLoops), pairToAliasStats(numIds) {}
+
+  // saturating, merged profiles of long runs can go past 32 bits
+  static void addWeighted(uint32_t& into, uint32_t val, uint32_t weight) {
+    uint64_t sum = (uint64_t)into + (uint64_t)val * weight;
+    into = (uint32_t)std::min<uint64_t>(sum, std::numeric_limits<uint32_t>::max());
+  }
+
+  /* Add the counts of other (which must come from the same module) weight times. Iteration stamps are
+     meaningless across runs, merged loop stats are only good for their frequencies. Phases of different runs
+     don't line up, they are left out */
+  void mergeWeighted(const AliasProfile& other, uint32_t weight) {
+    aliasStatsError.num_collisions += other.aliasStatsError.num_collisions * weight;
+    aliasStatsError.num_comparisons += other.aliasStatsError.num_comparisons * weight;
+    other.pairToAliasStats.forEach([&](size_t id_a, size_t id_b, const AliasStats& otherStats) {
+      if (otherStats.num_comparisons == 0) return;
+      auto& aliasStats = pairToAliasStats(id_a, id_b);
+      addWeighted(aliasStats.num_collisions, otherStats.num_collisions, weight);
+      addWeighted(aliasStats.num_comparisons, otherStats.num_comparisons, weight);
+    });
+    for (auto& [loopId, pairToLoopAliasStats] : other.loopIdToLoopAliasStats) {
+      auto& mergedLoopAliasStats = loopIdToLoopAliasStats[loopId];
+      for (auto& [pairKey, otherStats] : pairToLoopAliasStats) {
+        auto& loopAliasStats = mergedLoopAliasStats[pairKey];
+        addWeighted(loopAliasStats.num_iterations, otherStats.num_iterations, weight);
+        addWeighted(loopAliasStats.num_aliased_iterations, otherStats.num_aliased_iterations, weight);
+        addWeighted(loopAliasStats.num_cross_comparisons, otherStats.num_cross_comparisons, weight);
+        addWeighted(loopAliasStats.num_cross_collisions, otherStats.num_cross_collisions, weight);
+      }
+    }
+  }
+};
+
+/* Everything the profile is keyed on, computed from the un-instrumented module */
+struct ProfileIds : ReplayIds {
+  std::unordered_map<MemoryLocation, size_t> memLocToId;
+  uint64_t moduleHash = 0;
+};
+
+// FNV-1a, good enough to tell modules apart
+inline uint64_t hashBytes(uint64_t hash, const void* bytes, size_t len) {
+  for (size_t i = 0; i < len; ++i) hash = (hash ^ ((const unsigned char*)bytes)[i]) * 1099511628211ULL;
+  return hash;
+}
+
+// Changes whenever the ids of the module would: function names, their memory operations and their loops
+uint64_t getModuleProfileHash(Module& m, const LoopIds& loopIds) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto& func : m) {
+    if (func.isDeclaration()) continue;
+    auto name = func.getName();
+    hash = hashBytes(hash, name.data(), name.size());
+    uint64_t numMemInsts = 0;
+    for (auto& bb : func) {
+      for (auto& inst : bb) numMemInsts += MemoryLocation::getOrNone(&inst).hasValue();
+    }
+    hash = hashBytes(hash, &numMemInsts, sizeof(numMemInsts));
+  }
+  uint64_t numLoops = loopIds.parentId.size();
+  return hashBytes(hash, &numLoops, sizeof(numLoops));
+}
+
+/*
+Scopes an optimization can query pairs in: the locations accessed by a function (which covers its loop nests
+and the arguments of its calls), and, for every direct call passing pointers, the locations of the caller with
+the locations the callee accesses through its arguments. allPairs puts everything in a single scope
+*/
+CandidatePairs getCandidatePairs(Module& m, const std::unordered_map<MemoryLocation, size_t>& memLocToId, bool allPairs) {
+  CandidatePairs ret(memLocToId.size());
+  if (allPairs) {
+    std::vector<size_t> allIds(memLocToId.size());
+    for (size_t Id = 0; Id < allIds.size(); ++Id) allIds[Id] = Id;
+    ret.addScope(allIds);
+    return ret;
+  }
+
+  std::unordered_map<const Function*, std::vector<size_t>> funcToIds, funcToArgIds;
+  for (auto& func : m) {
+    std::unordered_set<size_t> funcIds, argIds;
+    for (auto& bb : func) {
+      for (auto& inst : bb) {
+        auto memLocOpt = MemoryLocation::getOrNone(&inst);
+        if (!memLocOpt.hasValue()) continue;
+        size_t Id = memLocToId.at(memLocOpt.getValue());
+        if (funcIds.insert(Id).second) funcToIds[&func].push_back(Id);
+        if (isa<Argument>(getUnderlyingObject(memLocOpt->Ptr)) && argIds.insert(Id).second) funcToArgIds[&func].push_back(Id);
+      }
+    }
+  }
+  for (auto& func : m) {
+    if (funcToIds.count(&func)) ret.addScope(funcToIds[&func]);
+  }
+
+  std::set<std::pair<const Function*, const Function*>> callerToCallee;
+  for (auto& func : m) {
+    for (auto& bb : func) {
+      for (auto& inst : bb) {
+        auto* call = dyn_cast<CallBase>(&inst);
+        auto* callee = call ? call->getCalledFunction() : nullptr;
+        if (!callee || callee == &func || !funcToIds.count(&func) || !funcToArgIds.count(callee)) continue;
+        if (llvm::any_of(call->args(), [](const Use& arg) { return arg->getType()->isPointerTy(); })) {
+          callerToCallee.insert({&func, callee});
+        }
+      }
+    }
+  }
+  for (auto& [caller, callee] : callerToCallee) {
+    std::vector<size_t> callIds = funcToIds[caller];
+    for (size_t Id : funcToArgIds[callee]) {
+      if (llvm::find(callIds, Id) == callIds.end()) callIds.push_back(Id);
+    }
+    ret.addScope(callIds);
+  }
+  return ret;
+}
+
+ProfileIds getProfileIds(Module& m, const std::function<LoopInfo&(Function&)>& getLoopInfo, bool allPairs = false) {
+  ProfileIds ret;
+  ret.memLocToId = getMemLocToId(m);
+  ret.loopIds = getLoopIds(m, getLoopInfo);
+  ret.candidatePairs = getCandidatePairs(m, ret.memLocToId, allPairs);
+  ret.moduleHash = getModuleProfileHash(m, ret.loopIds);
+
+  std::vector<const Value*> idToPtr(ret.memLocToId.size());
+  for (auto& [memLoc, Id] : ret.memLocToId) idToPtr[Id] = memLoc.Ptr;
+  ret.idToLoopId.assign(idToPtr.size(), 0);
+  ret.idToPtrClass.resize(idToPtr.size());
+  std::unordered_map<const Value*, size_t> ptrToClass;
+  auto frameIds = getFrameIds(m, ret.memLocToId);
+  ret.frameIdToIds.resize(frameIds.size() + 1);
+  for (size_t Id = 0; Id < idToPtr.size(); ++Id) {
+    ret.idToLoopId[Id] = ret.loopIds.getLoopId(idToPtr[Id]);
+    ret.idToPtrClass[Id] = ptrToClass.emplace(idToPtr[Id], Id).first->second;
+    auto it = frameIds.find(getStackFrameFunction(idToPtr[Id]));
+    if (it != frameIds.end()) ret.frameIdToIds[it->second].push_back(Id);
+  }
+  return ret;
+}
+
+AliasProfile getEngineProfile(const ProfileIds& profileIds, const AliasEngine& aliasEngine) {
+  AliasProfile profile(profileIds.moduleHash, profileIds.idToLoopId.size(), profileIds.loopIds.parentId.size());
+  profile.aliasStatsError = aliasEngine.getAliasStatsError();
+  profile.pairToAliasStats = aliasEngine.getAliasStats();
+  profile.loopIdToLoopAliasStats = aliasEngine.getLoopAliasStats();
+  return profile;
+}
+
+/* Replay the trace with numThreads threads (see replayTraceParts), sketchMemory is the budget of the approximate mode
+   in bytes (0 for exact counts). When phaseDetection finds several phases, every segment of the trace is replayed
+   on its own and its stats are added to the ones of its phase. Fails if the trace wasn't made by this module */
+bool replayTraceToProfile(AliasProfile& profile, const ProfileIds& profileIds, const std::string& tracePath, unsigned numThreads,
+                          size_t sketchMemory, const PhaseDetection& phaseDetection, std::string& error) {
+  MappedTrace trace(tracePath);
+  TracePhases tracePhases = detectTracePhases(trace, phaseDetection, numThreads);
+  std::vector<uint64_t> partStarts = getPartStarts(trace.size, numThreads, tracePhases.segmentStarts);
+  std::vector<AliasEngine> engines;
+  if (!replayTraceParts(engines, trace, partStarts, numThreads, profileIds, sketchMemory, error)) {
+    error = tracePath + " was made for another module (" + error + ")";
+    return false;
+  }
+
+  std::vector<AliasProfile> phases;
+  for (size_t phase = 0; tracePhases.numPhases > 1 && phase < tracePhases.numPhases; ++phase) {
+    phases.emplace_back(profileIds.moduleHash, profileIds.idToLoopId.size(), profileIds.loopIds.parentId.size());
+  }
+  std::optional<AliasEngine> aliasEngine;
+  size_t part = 0;
+  for (size_t segment = 0; segment < tracePhases.segmentStarts.size(); ++segment) {
+    uint64_t segmentEnd = segment + 1 < tracePhases.segmentStarts.size() ? tracePhases.segmentStarts[segment + 1] : trace.size;
+    AliasEngine segmentEngine = std::move(engines[part++]);
+    while (part < engines.size() && partStarts[part] < segmentEnd) segmentEngine.mergeFollowing(std::move(engines[part++]));
+    if (!phases.empty()) phases[tracePhases.segmentToPhase[segment]].mergeWeighted(getEngineProfile(profileIds, segmentEngine), 1);
+    if (!aliasEngine) aliasEngine.emplace(std::move(segmentEngine));
+    else aliasEngine->mergeFollowing(std::move(segmentEngine));
+  }
+
+  profile = getEngineProfile(profileIds, *aliasEngine);
+  profile.phases = std::move(phases);
+  return true;
+}
+
+// header and records of the profile, then the same for each of its phases
+void writeAliasProfileSection(std::ofstream& out, const AliasProfile& profile) {
+  std::vector<AliasProfilePairRecord> pairRecords;
+  profile.pairToAliasStats.forEach([&](size_t id_a, size_t id_b, const AliasStats& aliasStats) {
+    if (aliasStats.num_comparisons == 0) return;
+    pairRecords.push_back({(uint32_t)id_a, (uint32_t)id_b, aliasStats.num_collisions, aliasStats.num_comparisons});
+  });
+  std::sort(pairRecords.begin(), pairRecords.end(), [](const auto& lhs, const auto& rhs) {
+    return std::make_pair(lhs.id_a, lhs.id_b) < std::make_pair(rhs.id_a, rhs.id_b);
+  });
+
+  std::vector<AliasProfileLoopRecord> loopRecords;
+  for (auto& [loopId, pairToLoopAliasStats] : profile.loopIdToLoopAliasStats) {
+    for (auto& [pairKey, loopAliasStats] : pairToLoopAliasStats) {
+      auto [id_a, id_b] = getIdPairFromKey(pairKey);
+      loopRecords.push_back({(uint32_t)loopId, (uint32_t)id_a, (uint32_t)id_b, loopAliasStats.num_iterations,
+        loopAliasStats.num_aliased_iterations, loopAliasStats.num_cross_comparisons, loopAliasStats.num_cross_collisions});
+    }
+  }
+  std::sort(loopRecords.begin(), loopRecords.end(), [](const auto& lhs, const auto& rhs) {
+    return std::make_tuple(lhs.loop_id, lhs.id_a, lhs.id_b) < std::make_tuple(rhs.loop_id, rhs.id_a, rhs.id_b);
+  });
+
+  AliasProfileHeader header = {profile.moduleHash, profile.numIds, profile.numLoops, pairRecords.size(), loopRecords.size(),
+    profile.aliasStatsError.num_collisions, profile.aliasStatsError.num_comparisons, profile.phases.size()};
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)pairRecords.data(), pairRecords.size() * sizeof(AliasProfilePairRecord));
+  out.write((const char*)loopRecords.data(), loopRecords.size() * sizeof(AliasProfileLoopRecord));
+  for (auto& phase : profile.phases) writeAliasProfileSection(out, phase);
+}
+
+bool writeAliasProfile(const AliasProfile& profile, const std::string& path, std::string& error) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(FP_ALIAS_PROFILE_MAGIC, sizeof(FP_ALIAS_PROFILE_MAGIC) - 1);
+  writeAliasProfileSection(out, profile);
+  if (!out) {
+    error = "could not write " + path;
+    return false;
+  }
+  return true;
+}
+
+// reads the section starting at offset, which is moved past it
+bool readAliasProfileSection(AliasProfile& profile, const std::vector<char>& bytes, size_t& offset, const std::string& path,
+                             std::string& error) {
+  AliasProfileHeader header;
+  if (offset + sizeof(header) > bytes.size()) {
+    error = path + " is truncated";
+    return false;
+  }
+  std::memcpy(&header, bytes.data() + offset, sizeof(header));
+  size_t pairsOffset = offset + sizeof(header);
+  if (header.num_pairs > (bytes.size() - pairsOffset) / sizeof(AliasProfilePairRecord)
+      || header.num_loop_pairs > (bytes.size() - pairsOffset) / sizeof(AliasProfileLoopRecord)) {
+    error = path + " is truncated";
+    return false;
+  }
+  size_t loopsOffset = pairsOffset + header.num_pairs * sizeof(AliasProfilePairRecord);
+  offset = loopsOffset + header.num_loop_pairs * sizeof(AliasProfileLoopRecord);
+  if (offset > bytes.size()) {
+    error = path + " is truncated";
+    return false;
+  }
+
+  profile = AliasProfile(header.module_hash, header.num_ids, header.num_loops);
+  profile.aliasStatsError.num_collisions = header.collisions_error;
+  profile.aliasStatsError.num_comparisons = header.comparisons_error;
+  for (uint64_t i = 0; i < header.num_pairs; ++i) {
+    AliasProfilePairRecord record;
+    std::memcpy(&record, bytes.data() + pairsOffset + i * sizeof(record), sizeof(record));
+    if (record.id_a >= header.num_ids || record.id_b >= header.num_ids) {
+      error = path + " has a location id out of range";
+      return false;
+    }
+    auto& aliasStats = profile.pairToAliasStats(record.id_a, record.id_b);
+    aliasStats.num_collisions = record.num_collisions;
+    aliasStats.num_comparisons = record.num_comparisons;
+  }
+  for (uint64_t i = 0; i < header.num_loop_pairs; ++i) {
+    AliasProfileLoopRecord record;
+    std::memcpy(&record, bytes.data() + loopsOffset + i * sizeof(record), sizeof(record));
+    if (record.loop_id >= header.num_loops || record.id_a >= header.num_ids || record.id_b >= header.num_ids) {
+      error = path + " is corrupt";
+      return false;
+    }
+    auto& loopAliasStats = profile.loopIdToLoopAliasStats[record.loop_id][getIdPairKey(record.id_a, record.id_b)];
+    loopAliasStats.num_iterations = record.num_iterations;
+    loopAliasStats.num_aliased_iterations = record.num_aliased_iterations;
+    loopAliasStats.num_cross_comparisons = record.num_cross_comparisons;
+    loopAliasStats.num_cross_collisions = record.num_cross_collisions;
+  }
+  if (header.num_phases > (bytes.size() - offset) / sizeof(AliasProfileHeader)) {
+    error = path + " is truncated";
+    return false;
+  }
+  profile.phases.resize(header.num_phases);
+  for (auto& phase : profile.phases) {
+    if (!readAliasProfileSection(phase, bytes, offset, path, error)) return false;
+  }
+  return true;
+}
+
+bool readAliasProfile(AliasProfile& profile, const std::string& path, std::string& error) {
+  std::ifstream in(path, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  const size_t magicSize = sizeof(FP_ALIAS_PROFILE_MAGIC) - 1;
+  if (bytes.size() < magicSize || std::memcmp(bytes.data(), FP_ALIAS_PROFILE_MAGIC, magicSize) != 0) {
+    error = path + " is not an alias profile";
+    return false;
+  }
+  size_t offset = magicSize;
+  if (!readAliasProfileSection(profile, bytes, offset, path, error)) return false;
+  if (offset != bytes.size()) {
+    error = path + " has trailing bytes";
+    return false;
+  }
+  return true;
+}
+} // end of namespace fp583
+
+#endif /* _ALIAS_PROFILE_H_ */
@@ -0,0 +1,136 @@
+#ifndef _ALIAS_STATS_H_
+#define _ALIAS_STATS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+namespace fp583 {
+// the replay counts on 64 bits, the stats of the profile are 32 bits
+inline uint32_t saturateCount(uint64_t count) {
+  return (uint32_t)std::min<uint64_t>(count, UINT32_MAX);
+}
+
+struct AliasStats {
+  uint32_t num_collisions;
+  uint32_t num_comparisons;
+
+  AliasStats() : num_collisions(0), num_comparisons(0) {}
+};
+
+/* How far approximate alias stats (see CountMinSketch) can be from the real ones: a count c stands for anything
+   in [c - error, c]. All 0 for exact stats */
+struct AliasStatsError {
+  uint64_t num_collisions = 0;
+  uint64_t num_comparisons = 0;
+};
+
+/* Aliasing of a pair of locations within the iterations of one loop. A comparison is "intra" iteration
+   when the other location was observed in the same iteration, or is defined outside the loop (so its value
+   holds for the whole iteration), and "cross" iteration when it comes from an earlier iteration of the same
+   invocation of the loop, i.e. a loop-carried alias */
+struct LoopAliasStats {
+  uint32_t num_iterations; // iterations in which the pair was compared
+  uint32_t num_aliased_iterations; // iterations in which the pair collided at least once
+  uint32_t num_cross_comparisons;
+  uint32_t num_cross_collisions;
+  // stamps of the first and last iteration counted above, so an iteration is only counted once even when
+  // it's seen by the replay of 2 consecutive parts of the trace
+  uint64_t first_iteration, last_iteration;
+  uint64_t first_aliased_iteration, last_aliased_iteration;
+
+  LoopAliasStats() : num_iterations(0), num_aliased_iterations(0), num_cross_comparisons(0), num_cross_collisions(0),
+    first_iteration(0), last_iteration(0), first_aliased_iteration(0), last_aliased_iteration(0) {}
+
+  void countIteration(uint64_t iterationStamp) {
+    if (!first_iteration) first_iteration = iterationStamp;
+    last_iteration = iterationStamp;
+    num_iterations++;
+  }
+
+  void countAliasedIteration(uint64_t iterationStamp) {
+    if (!first_aliased_iteration) first_aliased_iteration = iterationStamp;
+    last_aliased_iteration = iterationStamp;
+    num_aliased_iterations++;
+  }
+
+  // next holds the stats of the part of the trace right after the one these stats come from
+  void mergeFollowing(const LoopAliasStats& next) {
+    num_iterations += next.num_iterations - (next.num_iterations && next.first_iteration == last_iteration);
+    num_aliased_iterations += next.num_aliased_iterations - (next.num_aliased_iterations && next.first_aliased_iteration == last_aliased_iteration);
+    num_cross_comparisons += next.num_cross_comparisons;
+    num_cross_collisions += next.num_cross_collisions;
+    if (!first_iteration) first_iteration = next.first_iteration;
+    if (!first_aliased_iteration) first_aliased_iteration = next.first_aliased_iteration;
+    if (next.last_iteration) last_iteration = next.last_iteration;
+    if (next.last_aliased_iteration) last_aliased_iteration = next.last_aliased_iteration;
+  }
+
+  // fraction of the iterations in which the 2 locations alias
+  double getIterationAliasFrequency() const {
+    return num_iterations ? (double)num_aliased_iterations / num_iterations : 0.0;
+  }
+
+  double getCrossIterationAliasFrequency() const {
+    return num_cross_comparisons ? (double)num_cross_collisions / num_cross_comparisons : 0.0;
+  }
+};
+
+/* What the profile says about how often 2 locations alias, with the number of samples it's based on. A ratio
+   over a handful of samples means nothing, so below the sample floor the estimate is unknown and callers
+   shouldn't speculate either way */
+struct AliasEstimate {
+  bool known = false;
+  uint64_t num_samples = 0;
+  uint64_t num_hits = 0;
+  double probability = 0.0;
+  double lower = 0.0, upper = 1.0; // Wilson score interval
+
+  AliasEstimate() {}
+
+  // z is the normal quantile of the interval, 1.96 for 95%. Approximate counts only ever overestimate, by up
+  // to hitsError and samplesError, the interval then covers the intervals of all the counts they stand for
+  AliasEstimate(uint64_t numHits, uint64_t numSamples, uint64_t minSamples, double z,
+                uint64_t hitsError = 0, uint64_t samplesError = 0)
+    : num_samples(numSamples), num_hits(numHits) {
+    uint64_t minNumHits = numHits - std::min(numHits, hitsError);
+    uint64_t minNumSamples = numSamples - std::min(numSamples, samplesError);
+    known = minNumSamples > 0 && minNumSamples >= minSamples;
+    if (numSamples == 0) return;
+    probability = (double)numHits / numSamples;
+    lower = getWilsonInterval(minNumHits, numSamples, z).first;
+    upper = getWilsonInterval(numHits, std::max(minNumSamples, numHits), z).second;
+  }
+
+  static std::pair<double, double> getWilsonInterval(uint64_t numHits, uint64_t numSamples, double z) {
+    if (numSamples == 0) return {0.0, 1.0};
+    double n = numSamples, p = (double)numHits / numSamples;
+    double denominator = 1 + z * z / n;
+    double center = (p + z * z / (2 * n)) / denominator;
+    double halfWidth = z * std::sqrt(p * (1 - p) / n + z * z / (4 * n * n)) / denominator;
+    return {std::max(0.0, center - halfWidth), std::min(1.0, center + halfWidth)};
+  }
+
+  // certain, e.g. a location with itself
+  static AliasEstimate certain(double probability) {
+    AliasEstimate estimate;
+    estimate.known = true;
+    estimate.probability = estimate.lower = estimate.upper = probability;
+    return estimate;
+  }
+};
+
+// Unordered pair of location ids packed in a single key, smallest id in the high bits
+inline uint64_t getIdPairKey(size_t id_a, size_t id_b) {
+  if (id_a > id_b) std::swap(id_a, id_b);
+  return ((uint64_t)id_a << 32) | (uint64_t)id_b;
+}
+
+inline std::pair<size_t, size_t> getIdPairFromKey(uint64_t key) {
+  return {(size_t)(key >> 32), (size_t)(key & 0xffffffff)};
+}
+} // end of namespace fp583
+
+#endif /* _ALIAS_STATS_H_ */
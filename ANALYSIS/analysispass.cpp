@@ -10,6 +10,7 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/Support/CommandLine.h"
 
 #include <vector>
 #include <string>
@@ -20,9 +21,36 @@
 #include <utility>
 
 #include "../PROFILE/helpers.hpp"
+#include "aliasStats.hpp"
+#include "aliasEngine.hpp"
+#include "aliasProfile.hpp"
+#include "pairMatrix.hpp"
+#include "parallelReplay.hpp"
 
 using namespace llvm;
 
+static cl::opt<std::string> TracePath("fp-trace", cl::init("../583simple/log.log"),
+  cl::desc("Trace written by the instrumented program"));
+static cl::opt<unsigned> AnalysisThreads("fp-analysis-threads", cl::init(std::thread::hardware_concurrency()),
+  cl::desc("Number of threads used to replay the trace"));
+static cl::opt<unsigned> MinAliasSamples("fp-min-alias-samples", cl::init(32),
+  cl::desc("Alias estimates based on fewer comparisons (or loop iterations) than this are unknown"));
+static cl::opt<double> AliasConfidenceZ("fp-alias-confidence-z", cl::init(1.96),
+  cl::desc("Normal quantile of the confidence interval of alias estimates (1.96 for 95%)"));
+static cl::opt<unsigned> SketchMemory("fp-sketch-memory", cl::init(0),
+  cl::desc("Replay in approximate mode, with this many MiB of count-min sketches for the pair counts, loop stats stay exact (0 for exact counts)"));
+static cl::opt<unsigned> PhaseWindow("fp-phase-window", cl::init(0),
+  cl::desc("Split the run in phases, comparing windows of this many MiB of trace (0 for a single phase)"));
+static cl::opt<double> PhaseSimilarity("fp-phase-similarity", cl::init(0.5),
+  cl::desc("Windows less alike than this to every phase so far start a new phase"));
+static cl::opt<unsigned> MaxPhases("fp-max-phases", cl::init(8), cl::desc("Maximum number of phases"));
+static cl::opt<bool> AllPairs("fp-all-pairs", cl::init(false),
+  cl::desc("Compare every pair of locations, not only the ones an optimization could ask about"));
+static cl::opt<std::string> ProfilePath("fp-profile", cl::init(""),
+  cl::desc("Load the alias stats from a .aliasprof (see fp-aliasprof) instead of replaying -fp-trace"));
+static cl::opt<std::string> WriteProfilePath("fp-write-profile", cl::init(""),
+  cl::desc("Save the alias stats replayed from -fp-trace as a .aliasprof"));
+
 /*
 TODO: address potential issue that our profile data might be invalidated by other transforming passes
 running BEFORE our last pass.
@@ -31,96 +59,133 @@ TODO: Debug analysis pass!!! classex optimization fails because getAliasProbabil
 TODO:  loop hoisting optimization (pls be easier than this)
 */
 
-struct MemLocPair {
-  MemoryLocation first, second;
-
-  bool operator==(const MemLocPair &other) const {
-    return (first == other.first && second == other.second)
-        || (second == other.first && first == other.second);
+namespace fp583 {
+struct InstLogAnalysis {
+  std::unordered_map<MemoryLocation, size_t> memLocToId;
+  PairMatrix<AliasStats> pairToAliasStats; // indexed by location ids
+  AliasStatsError aliasStatsError;
+  std::unordered_map<size_t, std::unordered_map<uint64_t, LoopAliasStats>> loopIdToLoopAliasStats; // keyed by getIdPairKey
+  std::unordered_map<const BasicBlock*, size_t> loopHeaderToId;
+  std::vector<AliasProfile> phases; // stats of every phase, empty when the run wasn't split in phases
+  uint64_t minAliasSamples = 0;
+  double aliasConfidenceZ = 1.96;
+
+  /* false if the location wasn't instrumented, e.g. it was created after the profile pass ran */
+  bool getLocationId(const MemoryLocation& loc, size_t& id) const {
+    auto it = memLocToId.find(loc);
+    if (it == memLocToId.end()) return false;
+    id = it->second;
+    return true;
   }
-};
 
-namespace std {
-  template <>
-  struct hash<MemLocPair> {
-    std::size_t operator()(const MemLocPair& p) const {
-      auto hash1 = std::hash<void*>{}((void*)p.first.Ptr);
-      auto hash2 = std::hash<void*>{}((void*)p.second.Ptr);
-      return hash1 ^ hash2;
-    }
-  };
-}
+  // from the stats of the whole run or of one of its phases
+  AliasEstimate getAliasEstimate(const PairMatrix<AliasStats>& pairStats, const AliasStatsError& pairStatsError,
+                                 size_t id_a, size_t id_b) const {
+    const AliasStats* aliasStats = pairStats.find(id_a, id_b);
+    if (!aliasStats) return AliasEstimate();
+    return AliasEstimate(aliasStats->num_collisions, aliasStats->num_comparisons, minAliasSamples, aliasConfidenceZ,
+                         pairStatsError.num_collisions, pairStatsError.num_comparisons);
+  }
 
+  AliasEstimate getAliasEstimate(size_t id_a, size_t id_b) const {
+    return getAliasEstimate(pairToAliasStats, aliasStatsError, id_a, id_b);
+  }
 
-namespace fp583 {
-struct AliasStats {
-  uint32_t num_collisions;
-  uint32_t num_comparisons;
+  /* Fraction of the comparisons in which the 2 locations held the same address, unknown for locations which
+     weren't profiled or were compared less than minAliasSamples times */
+  AliasEstimate getAliasEstimate(const MemoryLocation& loc_a, const MemoryLocation& loc_b) const {
+    if (loc_a.Ptr == loc_b.Ptr) {
+      return AliasEstimate::certain(1.0);
+    }
 
-  AliasStats() : num_collisions(0), num_comparisons(0) {}
-};
+    size_t id_a, id_b;
+    if (!getLocationId(loc_a, id_a) || !getLocationId(loc_b, id_b)) {
+      // errs() << "getAliasEstimate: not found\n";
+      return AliasEstimate();
+    }
+    return getAliasEstimate(id_a, id_b);
+  }
 
-struct InstLogAnalysis {
-  std::unordered_map<MemLocPair, AliasStats> memLocPairToAliasStats;
+  /* getAliasEstimate in every phase of the run, empty if it wasn't split in phases. A pair can be unlikely to
+     alias in a phase and likely to in another, which the estimate of the whole run averages away */
+  std::vector<AliasEstimate> getPhaseAliasEstimates(const MemoryLocation& loc_a, const MemoryLocation& loc_b) const {
+    std::vector<AliasEstimate> ret;
+    size_t id_a, id_b;
+    bool found = getLocationId(loc_a, id_a) && getLocationId(loc_b, id_b);
+    for (auto& phase : phases) {
+      if (loc_a.Ptr == loc_b.Ptr) ret.push_back(AliasEstimate::certain(1.0));
+      else ret.push_back(found ? getAliasEstimate(phase.pairToAliasStats, phase.aliasStatsError, id_a, id_b) : AliasEstimate());
+    }
+    return ret;
+  }
 
+  // Raw ratio, 0.0 when unknown. Prefer getAliasEstimate, which tells unknown and unlikely apart
   double getAliasProbability(const MemoryLocation& loc_a, const MemoryLocation& loc_b) const {
-    if (loc_a.Ptr == loc_b.Ptr) {
-      return 1.0;
-    }
+    return getAliasEstimate(loc_a, loc_b).probability;
+  }
 
-    // errs() << "lookup: " << *loc_a.Ptr << ' ' << *loc_b.Ptr << '\n';
+  /* nullptr if the pair was never compared in an iteration of L (e.g. the loop never ran while profiling) */
+  const LoopAliasStats* getLoopAliasStats(const Loop* L, const MemoryLocation& loc_a, const MemoryLocation& loc_b) const {
+    auto it_loop = loopHeaderToId.find(L->getHeader());
+    if (it_loop == loopHeaderToId.end()) return nullptr;
+    auto it_stats = loopIdToLoopAliasStats.find(it_loop->second);
+    if (it_stats == loopIdToLoopAliasStats.end()) return nullptr;
+    size_t id_a, id_b;
+    if (!getLocationId(loc_a, id_a) || !getLocationId(loc_b, id_b)) return nullptr;
+    auto it = it_stats->second.find(getIdPairKey(id_a, id_b));
+    return it == it_stats->second.end() ? nullptr : &it->second;
+  }
 
-    auto it = InstLogAnalysis::memLocPairToAliasStats.find({loc_a, loc_b});
-    if (it == InstLogAnalysis::memLocPairToAliasStats.end()) {
-      // errs() << "getAliasProbability: not found\n";
-      return 0.0;
-    }
-    // errs() << "getAliasProbability " << it->second.num_collisions << ' ' << it->second.num_comparisons << '\n';
-    return (double)it->second.num_collisions / it->second.num_comparisons;
+  /* Fraction of the iterations of L in which the 2 locations alias, unknown when the pair was compared in
+     less than minAliasSamples iterations */
+  AliasEstimate getIterationAliasEstimate(const Loop* L, const MemoryLocation& loc_a, const MemoryLocation& loc_b) const {
+    if (loc_a.Ptr == loc_b.Ptr) return AliasEstimate::certain(1.0);
+    const LoopAliasStats* loopAliasStats = getLoopAliasStats(L, loc_a, loc_b);
+    if (!loopAliasStats) return AliasEstimate();
+    return AliasEstimate(loopAliasStats->num_aliased_iterations, loopAliasStats->num_iterations, minAliasSamples, aliasConfidenceZ);
   }
 };
 
 struct InstLogAnalysisWrapperPass : public ModulePass {
   static char ID;
-  std::unordered_map<size_t, MemoryLocation> idToMemLoc;
+  ProfileIds profileIds;
 
   InstLogAnalysisWrapperPass() : ModulePass(ID) {}
 
-  std::unordered_map<size_t, MemoryLocation> getIdToMemLocMapping(Module &m) const {
-    std::unordered_map<MemoryLocation, size_t> memLocToId = getMemLocToId(m);
-    std::unordered_map<size_t, MemoryLocation> idToMemLoc;
-    for (auto& [memLoc, Id] : memLocToId) {
-      idToMemLoc[Id] = memLoc;
-    }
-    return idToMemLoc;
+  void getAnalysisUsage(AnalysisUsage& AU) const override {
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.setPreservesAll();
   }
 
-  std::unordered_map<MemLocPair, AliasStats> parseLogAndGetAliasStats() const {
-    std::unordered_map<size_t, uint64_t> idToShadowValue;
-    std::unordered_map<MemLocPair, AliasStats> memLocPairToAliasStats;
-
-    size_t instIdIn = 0;
-    void* memAddrIn_void = nullptr;
-    std::ifstream ins("../583simple/log.log");
-    while (ins >> instIdIn >> memAddrIn_void) {
-      uint64_t memAddrIn = (uint64_t)memAddrIn_void;
-      auto memLocIn = idToMemLoc.at(instIdIn);
-      idToShadowValue[instIdIn] = memAddrIn;
-      for (auto it_shadow = idToShadowValue.begin(); it_shadow != idToShadowValue.end(); ++it_shadow) {
-        auto memLocCompare = idToMemLoc.at(it_shadow->first);
-        uint64_t memAddrCompare = it_shadow->second;
-
-        if (memLocCompare.Ptr != memLocIn.Ptr) { // don't compute aliasing stats with itself
-          auto& pairAliasStats = memLocPairToAliasStats[{memLocIn, memLocCompare}];
-          pairAliasStats.num_comparisons++;
-          if (memAddrIn == memAddrCompare) {
-            pairAliasStats.num_collisions++;
-          }
-        }
+  AliasProfile getAliasProfile() const {
+    if (!ProfilePath.empty()) {
+      AliasProfile profile;
+      std::string error;
+      if (!readAliasProfile(profile, ProfilePath, error)) {
+        errs() << "fp_analysis: " << error << ", no alias stats loaded\n";
+        return AliasProfile();
       }
+      if (profile.moduleHash != profileIds.moduleHash) {
+        errs() << "fp_analysis: " << ProfilePath << " was made for another module, no alias stats loaded\n";
+        return AliasProfile();
+      }
+      return profile;
     }
 
-    return memLocPairToAliasStats;
+    PhaseDetection phaseDetection;
+    phaseDetection.windowSize = (uint64_t)PhaseWindow << 20;
+    phaseDetection.minSimilarity = PhaseSimilarity;
+    phaseDetection.maxPhases = MaxPhases;
+    AliasProfile profile;
+    std::string error;
+    if (!replayTraceToProfile(profile, profileIds, TracePath, AnalysisThreads, (size_t)SketchMemory << 20, phaseDetection, error)) {
+      errs() << "fp_analysis: " << error << ", no alias stats loaded\n";
+      return AliasProfile();
+    }
+    if (!WriteProfilePath.empty() && !writeAliasProfile(profile, WriteProfilePath, error)) {
+      errs() << "fp_analysis: " << error << '\n';
+    }
+    return profile;
   }
 
   void testGetAliasProba(Module& m, size_t targetId_a, size_t targetId_b) {
@@ -151,11 +216,19 @@ struct InstLogAnalysisWrapperPass : public ModulePass {
 
   bool runOnModule(Module &m) override {
     // TODO: use morgans function and flip
-    idToMemLoc = getIdToMemLocMapping(m);
-
-    std::unordered_map<MemLocPair, AliasStats> memLocPairToAliasStats = parseLogAndGetAliasStats();
-
-    instLogAnalysis.memLocPairToAliasStats = memLocPairToAliasStats;
+    profileIds = getProfileIds(m, [this](Function& f) -> LoopInfo& {
+      return getAnalysis<LoopInfoWrapperPass>(f).getLoopInfo();
+    }, AllPairs);
+
+    AliasProfile profile = getAliasProfile();
+    instLogAnalysis.memLocToId = profileIds.memLocToId;
+    instLogAnalysis.pairToAliasStats = std::move(profile.pairToAliasStats);
+    instLogAnalysis.aliasStatsError = profile.aliasStatsError;
+    instLogAnalysis.phases = std::move(profile.phases);
+    instLogAnalysis.loopIdToLoopAliasStats = std::move(profile.loopIdToLoopAliasStats);
+    instLogAnalysis.loopHeaderToId = profileIds.loopIds.headerToId;
+    instLogAnalysis.minAliasSamples = MinAliasSamples;
+    instLogAnalysis.aliasConfidenceZ = AliasConfidenceZ;
 
     // testGetAliasProba(m, 2, 5);
     // testGetAliasProba(m, 12, 8);
@@ -0,0 +1,68 @@
+#ifndef _COUNT_MIN_SKETCH_H_
+#define _COUNT_MIN_SKETCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fp583 {
+
+/*
+Count-min sketch (Cormode & Muthukrishnan) of counts keyed by uint64_t: kDepth rows of width counters, a key adds
+to one counter per row and its estimate is the smallest of them. Memory only depends on width, however many keys.
+
+Counts can go down as long as the final count of every key is >= 0 (a decrement only takes back an earlier or later
+increment of the same key). Then an estimate is never below the key's count and, with probability 1 - e^-kDepth,
+at most getErrorBound() above it.
+
+Sketches of the same width add up, the sum being the sketch of the concatenated streams.
+*/
+struct CountMinSketch {
+  static constexpr size_t kDepth = 4;
+
+  size_t width = 0;
+  std::vector<int64_t> counters; // kDepth rows of width
+  int64_t totalCount = 0; // sum of the counts of all keys
+
+  explicit CountMinSketch(size_t width = 0) : width(width), counters(kDepth * width, 0) {}
+
+  // widest sketch fitting in numBytes
+  static size_t getWidth(size_t numBytes) { return std::max<size_t>(1, numBytes / (kDepth * sizeof(int64_t))); }
+
+  bool empty() const { return width == 0; }
+
+  // splitmix64 finalizer, with a different seed per row so rows collide independently
+  size_t getCounterIndex(size_t row, uint64_t key) const {
+    uint64_t hash = key + 0x9e3779b97f4a7c15ULL * (row + 1);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return row * width + hash % width;
+  }
+
+  void add(uint64_t key, int64_t count) {
+    for (size_t row = 0; row < kDepth; ++row) counters[getCounterIndex(row, key)] += count;
+    totalCount += count;
+  }
+
+  uint64_t estimate(uint64_t key) const {
+    int64_t ret = counters[getCounterIndex(0, key)];
+    for (size_t row = 1; row < kDepth; ++row) ret = std::min(ret, counters[getCounterIndex(row, key)]);
+    return std::max<int64_t>(ret, 0);
+  }
+
+  // e / width of the total count
+  uint64_t getErrorBound() const {
+    return totalCount > 0 ? (uint64_t)std::ceil(std::exp(1.0) * totalCount / width) : 0;
+  }
+
+  void merge(const CountMinSketch& other) {
+    for (size_t i = 0; i < counters.size(); ++i) counters[i] += other.counters[i];
+    totalCount += other.totalCount;
+  }
+};
+} // end of namespace fp583
+
+#endif /* _COUNT_MIN_SKETCH_H_ */
@@ -0,0 +1,120 @@
+#ifndef _PAIR_MATRIX_H_
+#define _PAIR_MATRIX_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fp583 {
+
+/*
+Upper triangle of a numIds x numIds matrix, one T per unordered pair of location ids.
+
+The triangle is cut in kTileSize x kTileSize tiles which are only allocated once one of their pairs is
+written, so pairs close in id (which are defined close to each other in the program) share cache lines.
+Tiles are found through a flat triangular array of tile pointers, or through a hash map of tiles when
+there are so many ids that even the array of pointers would be too big.
+*/
+template <typename T>
+struct PairMatrix {
+  static constexpr size_t kTileSize = 64;
+  static constexpr size_t kMaxDirectTiles = 1 << 22;
+
+  size_t numIds = 0;
+  size_t numTilesPerRow = 0;
+  std::vector<std::unique_ptr<T[]>> directTiles; // tile (row, col), row <= col, at col * (col + 1) / 2 + row
+  std::unordered_map<uint64_t, std::unique_ptr<T[]>> sparseTiles;
+
+  explicit PairMatrix(size_t numIds = 0) : numIds(numIds), numTilesPerRow((numIds + kTileSize - 1) / kTileSize) {
+    size_t numTiles = numTilesPerRow * (numTilesPerRow + 1) / 2;
+    if (numTiles <= kMaxDirectTiles) directTiles.resize(numTiles);
+  }
+
+  bool isSparse() const { return directTiles.empty() && numTilesPerRow > 0; }
+
+  T& operator()(size_t id_a, size_t id_b) {
+    if (id_a > id_b) std::swap(id_a, id_b);
+    auto& tile = getTile(id_a / kTileSize, id_b / kTileSize);
+    if (!tile) tile.reset(new T[kTileSize * kTileSize]());
+    return tile[(id_a % kTileSize) * kTileSize + id_b % kTileSize];
+  }
+
+  /* nullptr if nothing was ever written close to the pair */
+  const T* find(size_t id_a, size_t id_b) const {
+    if (id_a > id_b) std::swap(id_a, id_b);
+    if (id_b >= numIds) return nullptr;
+    const T* tile = findTile(id_a / kTileSize, id_b / kTileSize);
+    return tile ? &tile[(id_a % kTileSize) * kTileSize + id_b % kTileSize] : nullptr;
+  }
+
+  /* Call action(id_a, id_b, value) with id_a < id_b for every pair of the allocated tiles */
+  template <typename ACTION_T>
+  void forEach(ACTION_T&& action) {
+    forEachTile([&](size_t row, size_t col, T* tile) {
+      for (size_t id_a = row * kTileSize; id_a < std::min(numIds, (row + 1) * kTileSize); ++id_a) {
+        for (size_t id_b = std::max(id_a + 1, col * kTileSize); id_b < std::min(numIds, (col + 1) * kTileSize); ++id_b) {
+          action(id_a, id_b, tile[(id_a % kTileSize) * kTileSize + id_b % kTileSize]);
+        }
+      }
+    });
+  }
+
+  template <typename ACTION_T>
+  void forEach(ACTION_T&& action) const {
+    const_cast<PairMatrix*>(this)->forEach([&](size_t id_a, size_t id_b, const T& value) { action(id_a, id_b, value); });
+  }
+
+private:
+  uint64_t getTileKey(size_t row, size_t col) const { return (uint64_t)col * (col + 1) / 2 + row; }
+
+  std::unique_ptr<T[]>& getTile(size_t row, size_t col) {
+    return isSparse() ? sparseTiles[getTileKey(row, col)] : directTiles[getTileKey(row, col)];
+  }
+
+  const T* findTile(size_t row, size_t col) const {
+    if (!isSparse()) return directTiles[getTileKey(row, col)].get();
+    auto it = sparseTiles.find(getTileKey(row, col));
+    return it == sparseTiles.end() ? nullptr : it->second.get();
+  }
+
+  // inverse of getTileKey
+  std::pair<size_t, size_t> getTileRowCol(uint64_t key) const {
+    auto col = (uint64_t)((std::sqrt(8.0 * (double)key + 1) - 1) / 2);
+    while (col * (col + 1) / 2 > key) --col;
+    while ((col + 1) * (col + 2) / 2 <= key) ++col;
+    return {(size_t)(key - col * (col + 1) / 2), (size_t)col};
+  }
+
+  /* Visits the allocated tiles in key order either way, so what's built from them doesn't depend on the mode.
+  The sparse tiles are visited through their sorted keys rather than by looking up every tile of the triangle */
+  template <typename ACTION_T>
+  void forEachTile(ACTION_T&& action) {
+    if (!isSparse()) {
+      for (uint64_t key = 0; key < directTiles.size(); ++key) {
+        if (auto& tile = directTiles[key]) {
+          auto [row, col] = getTileRowCol(key);
+          action(row, col, tile.get());
+        }
+      }
+      return;
+    }
+    std::vector<uint64_t> keys;
+    keys.reserve(sparseTiles.size());
+    for (auto& [key, tile] : sparseTiles) {
+      if (tile) keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (auto key : keys) {
+      auto [row, col] = getTileRowCol(key);
+      action(row, col, sparseTiles[key].get());
+    }
+  }
+};
+} // end of namespace fp583
+
+#endif /* _PAIR_MATRIX_H_ */
@@ -0,0 +1,175 @@
+#ifndef _PARALLEL_REPLAY_H_
+#define _PARALLEL_REPLAY_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aliasEngine.hpp"
+#include "traceReader.hpp"
+
+namespace fp583 {
+
+/*
+Effect of a part of the trace on the replay state, without knowing the state it starts from.
+Stamps are local to the part, 0 standing for "the stamp the loop had when the part started".
+Applying the deltas of consecutive parts in order gives the state at the start of each part,
+which is what lets them be replayed in parallel and still match a sequential replay exactly
+*/
+struct ReplayStateDelta {
+  struct IdDelta {
+    uint64_t num_events = 0;
+    uint64_t num_iterations_after_first = 0; // the first event's depends on the state before this part
+    uint64_t first_stamp = 0, last_stamp = 0;
+    uint64_t last_addr = 0;
+    bool expired_before_first = false, expired_since_last = false;
+  };
+
+  const ReplayIds& ids;
+  std::vector<IdDelta> idToDelta;
+  std::vector<uint64_t> loopToIterationStamp, loopToInvocationFirstStamp; // 0 if the loop had no marker in this part
+  uint64_t stampClock = 0;
+  uint64_t numInvalidRecords = 0; // see ReplayIds::isValidRecord, they are skipped
+
+  ReplayStateDelta(const ReplayIds& ids)
+    : ids(ids), idToDelta(ids.idToLoopId.size()), loopToIterationStamp(ids.loopIds.parentId.size(), 0),
+      loopToInvocationFirstStamp(ids.loopIds.parentId.size(), 0) {}
+
+  void processRecord(size_t id, uint64_t payload) {
+    if (!ids.isValidRecord(id, payload)) numInvalidRecords++;
+    else if (id >= FP_TRACE_FIRST_MARKER_ID) processMarker(id, payload);
+    else processEvent(id, payload);
+  }
+
+  void processMarker(size_t markerId, size_t payload) {
+    if (markerId == FP_TRACE_FRAME_EXIT_ID) {
+      for (size_t id : ids.frameIdToIds[payload]) {
+        auto& delta = idToDelta[id];
+        if (delta.num_events == 0) delta.expired_before_first = true;
+        delta.expired_since_last = true;
+      }
+    }
+    else if (markerId == FP_TRACE_LOOP_ENTER_ID) loopToInvocationFirstStamp[payload] = stampClock + 1;
+    else if (markerId == FP_TRACE_LOOP_ITER_ID) loopToIterationStamp[payload] = ++stampClock;
+  }
+
+  void processEvent(size_t idIn, uint64_t addrIn) {
+    auto& delta = idToDelta[idIn];
+    size_t loopId = ids.idToLoopId[idIn];
+    uint64_t stamp = loopToIterationStamp[loopId];
+    if (delta.num_events == 0) delta.first_stamp = stamp;
+    else if (loopId != 0 && (delta.expired_since_last || stamp != delta.last_stamp)) delta.num_iterations_after_first++;
+    delta.num_events++;
+    delta.last_stamp = stamp;
+    delta.last_addr = addrIn;
+    delta.expired_since_last = false;
+  }
+
+  void applyTo(AliasEngine::ReplayState& state) const {
+    uint64_t stampOffset = state.stampClock;
+    auto toGlobalStamp = [&](uint64_t localStamp, size_t loopId) {
+      return localStamp ? stampOffset + localStamp : state.loopStates[loopId].iteration_stamp;
+    };
+
+    for (size_t id = 0; id < idToDelta.size(); ++id) {
+      const auto& delta = idToDelta[id];
+      auto& shadow = state.idToShadowValue[id];
+      if (delta.num_events == 0) {
+        if (delta.expired_since_last) shadow.valid = false;
+        continue;
+      }
+      size_t loopId = ids.idToLoopId[id];
+      uint64_t firstStamp = toGlobalStamp(delta.first_stamp, loopId);
+      if (loopId != 0 && (!shadow.valid || delta.expired_before_first || shadow.iteration_stamp != firstStamp)) {
+        state.idToNumIterations[id]++;
+      }
+      state.idToNumIterations[id] += delta.num_iterations_after_first;
+      state.idToNumEvents[id] += delta.num_events;
+      shadow = {delta.last_addr, toGlobalStamp(delta.last_stamp, loopId), !delta.expired_since_last};
+    }
+
+    for (size_t loopId = 0; loopId < loopToIterationStamp.size(); ++loopId) {
+      if (loopToIterationStamp[loopId]) state.loopStates[loopId].iteration_stamp = stampOffset + loopToIterationStamp[loopId];
+      if (loopToInvocationFirstStamp[loopId]) state.loopStates[loopId].invocation_first_stamp = stampOffset + loopToInvocationFirstStamp[loopId];
+    }
+    state.stampClock += stampClock;
+  }
+};
+
+/* Start of every part of the trace replayed by its own engine: at most numThreads parts of similar size, except that
+   parts also start at every boundary given (e.g. phase segments, see TracePhases) */
+std::vector<uint64_t> getPartStarts(uint64_t traceSize, unsigned numThreads, const std::vector<uint64_t>& boundaries = {0}) {
+  numThreads = std::max(1u, std::min<unsigned>(numThreads, traceSize / (1 << 20) + 1)); // not worth it for small traces
+  std::vector<uint64_t> ret = boundaries;
+  for (unsigned part = 0; part < numThreads; ++part) ret.push_back(traceSize * part / numThreads);
+  std::sort(ret.begin(), ret.end());
+  ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+  return ret;
+}
+
+/*
+Replay every part of the trace (starting at partStarts, the first one at 0) with its own AliasEngine, numThreads
+parts at a time:
+  1. every part computes its ReplayStateDelta
+  2. deltas are applied in order, giving the state at the start of every part
+  3. every part is replayed by its own AliasEngine starting from that state
+Merging the engines in order (see AliasEngine::mergeFollowing) gives the same stats as a sequential replay, the
+engine of a part alone has the stats of the events of that part.
+A non zero sketchMemory (in bytes) replays in approximate mode, the budget being shared by the engines of all parts.
+Fails if the trace has records the module can't have written (e.g. the trace of another module), before step 3
+*/
+bool replayTraceParts(std::vector<AliasEngine>& engines, const MappedTrace& trace, const std::vector<uint64_t>& partStarts,
+                      unsigned numThreads, const ReplayIds& ids, size_t sketchMemory, std::string& error) {
+  size_t numParts = partStarts.size();
+  auto getPartBounds = [&](size_t part) {
+    return std::make_pair(partStarts[part], part + 1 < numParts ? partStarts[part + 1] : trace.size);
+  };
+  auto forEachPart = [&](const std::function<void(size_t)>& action) {
+    std::atomic<size_t> nextPart(0);
+    std::vector<std::thread> threads;
+    for (unsigned thread = 0; thread < std::min<size_t>(std::max(1u, numThreads), numParts); ++thread) {
+      threads.emplace_back([&] {
+        for (size_t part = nextPart++; part < numParts; part = nextPart++) action(part);
+      });
+    }
+    for (auto& thread : threads) thread.join();
+  };
+
+  std::vector<ReplayStateDelta> deltas(numParts, ReplayStateDelta(ids));
+  forEachPart([&](size_t part) {
+    auto [begin, end] = getPartBounds(part);
+    trace.forEachRecord(begin, end, [&](size_t id, uint64_t addr) { deltas[part].processRecord(id, addr); });
+  });
+  uint64_t numInvalidRecords = 0;
+  for (auto& delta : deltas) numInvalidRecords += delta.numInvalidRecords;
+  if (numInvalidRecords) {
+    error = std::to_string(numInvalidRecords) + " records have ids, loops or frames the module doesn't have";
+    return false;
+  }
+
+  std::vector<AliasEngine::ReplayState> initialStates(1, AliasEngine::ReplayState(ids.idToLoopId.size(), ids.loopIds.parentId.size()));
+  for (size_t part = 0; part + 1 < numParts; ++part) {
+    initialStates.push_back(initialStates.back());
+    deltas[part].applyTo(initialStates.back());
+  }
+  deltas.clear();
+
+  size_t sketchWidth = sketchMemory ? CountMinSketch::getWidth(sketchMemory / (numParts * 3)) : 0; // 3 sketches per engine
+  engines.clear();
+  for (auto& initialState : initialStates) engines.emplace_back(ids, std::move(initialState), sketchWidth);
+  initialStates.clear();
+  forEachPart([&](size_t part) {
+    auto [begin, end] = getPartBounds(part);
+    trace.forEachRecord(begin, end, [&](size_t id, uint64_t addr) {
+      if (id >= FP_TRACE_FIRST_MARKER_ID) engines[part].processMarker(id, addr);
+      else engines[part].processEvent(id, addr);
+    });
+  });
+  return true;
+}
+} // end of namespace fp583
+
+#endif /* _PARALLEL_REPLAY_H_ */
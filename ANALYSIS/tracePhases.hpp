@@ -0,0 +1,103 @@
+#ifndef _TRACE_PHASES_H_
+#define _TRACE_PHASES_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "traceReader.hpp"
+
+namespace fp583 {
+
+struct PhaseDetection {
+  uint64_t windowSize = 0; // bytes of trace, 0 for a single phase
+  double minSimilarity = 0.5;
+  size_t maxPhases = 8;
+};
+
+/* Consecutive windows of the same phase form a segment, segments are the parts of the trace replayed per phase */
+struct TracePhases {
+  std::vector<uint64_t> segmentStarts = {0}; // byte offsets in the trace
+  std::vector<size_t> segmentToPhase = {0};
+  size_t numPhases = 1;
+};
+
+// Events of every location id in a window of the trace, sorted by id
+using WindowProfile = std::vector<std::pair<size_t, uint64_t>>;
+
+// Weighted Jaccard similarity of the fractions of the events of each window, sum of the min over sum of the max
+inline double getWindowSimilarity(const WindowProfile& lhs, const WindowProfile& rhs) {
+  auto getNumEvents = [](const WindowProfile& window) {
+    uint64_t ret = 0;
+    for (auto& [id, numEvents] : window) ret += numEvents;
+    return std::max<uint64_t>(ret, 1);
+  };
+  double lhsNumEvents = getNumEvents(lhs), rhsNumEvents = getNumEvents(rhs);
+  double sumMin = 0.0, sumMax = 0.0;
+  auto it_lhs = lhs.begin(), it_rhs = rhs.begin();
+  while (it_lhs != lhs.end() || it_rhs != rhs.end()) {
+    if (it_rhs == rhs.end() || (it_lhs != lhs.end() && it_lhs->first < it_rhs->first)) sumMax += (it_lhs++)->second / lhsNumEvents;
+    else if (it_lhs == lhs.end() || it_rhs->first < it_lhs->first) sumMax += (it_rhs++)->second / rhsNumEvents;
+    else {
+      double lhsFraction = (it_lhs++)->second / lhsNumEvents, rhsFraction = (it_rhs++)->second / rhsNumEvents;
+      sumMin += std::min(lhsFraction, rhsFraction);
+      sumMax += std::max(lhsFraction, rhsFraction);
+    }
+  }
+  return sumMax > 0.0 ? sumMin / sumMax : 1.0;
+}
+
+/*
+Cut the trace in windows of windowSize bytes and put every window in the phase it is the most similar to, where
+similarity compares the share of the events each location id has in both. A phase is represented by its first window, a
+window at least minSimilarity alike to none of them starts a new phase (unless there are maxPhases already), so
+a program going back to an earlier behavior (compress, decompress, compress again) goes back to the same phase.
+*/
+TracePhases detectTracePhases(const MappedTrace& trace, const PhaseDetection& detection, unsigned numThreads) {
+  TracePhases ret;
+  if (detection.windowSize == 0 || trace.size <= detection.windowSize) return ret;
+
+  size_t numWindows = (trace.size + detection.windowSize - 1) / detection.windowSize;
+  std::vector<WindowProfile> windowProfiles(numWindows);
+  std::vector<std::thread> threads;
+  for (unsigned thread = 0; thread < std::max(1u, numThreads); ++thread) {
+    threads.emplace_back([&, thread] {
+      for (size_t window = thread; window < numWindows; window += std::max(1u, numThreads)) {
+        std::unordered_map<size_t, uint64_t> idToNumEvents;
+        trace.forEachRecord(window * detection.windowSize, (window + 1) * detection.windowSize, [&](size_t id, uint64_t) {
+          if (id < FP_TRACE_FIRST_MARKER_ID) idToNumEvents[id]++;
+        });
+        windowProfiles[window].assign(idToNumEvents.begin(), idToNumEvents.end());
+        std::sort(windowProfiles[window].begin(), windowProfiles[window].end());
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  std::vector<size_t> phaseToWindow = {0};
+  for (size_t window = 1; window < numWindows; ++window) {
+    size_t phase = 0;
+    double similarity = -1.0;
+    for (size_t candidate = 0; candidate < phaseToWindow.size(); ++candidate) {
+      double candidateSimilarity = getWindowSimilarity(windowProfiles[window], windowProfiles[phaseToWindow[candidate]]);
+      if (candidateSimilarity > similarity) std::tie(phase, similarity) = std::make_pair(candidate, candidateSimilarity);
+    }
+    if (similarity < detection.minSimilarity && phaseToWindow.size() < detection.maxPhases) {
+      phase = phaseToWindow.size();
+      phaseToWindow.push_back(window);
+    }
+    if (phase != ret.segmentToPhase.back()) {
+      ret.segmentStarts.push_back(window * detection.windowSize);
+      ret.segmentToPhase.push_back(phase);
+    }
+  }
+  ret.numPhases = phaseToWindow.size();
+  return ret;
+}
+} // end of namespace fp583
+
+#endif /* _TRACE_PHASES_H_ */
@@ -0,0 +1,177 @@
+#ifndef _TRACE_READER_H_
+#define _TRACE_READER_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../fp_trace.h"
+
+namespace fp583 {
+
+// Decimal value of 8 ASCII digits at once (SWAR), first digit is the most significant
+inline uint64_t parseDecimal8(const char* digits) {
+  uint64_t val;
+  std::memcpy(&val, digits, 8);
+  val = (val & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+  val = (val & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+  return (val & 0x0000FFFF0000FFFF) * 42949672960001 >> 32;
+}
+
+// Value of 8 hex digits at once (SWAR), upper or lower case
+inline uint64_t parseHex8(const char* digits) {
+  uint64_t val;
+  std::memcpy(&val, digits, 8);
+  val = (val & 0x0F0F0F0F0F0F0F0F) + ((val >> 6) & 0x0101010101010101) * 9; // one nibble per byte
+  val = ((val << 4) | (val >> 8)) & 0x00FF00FF00FF00FF;
+  val = ((val << 8) | (val >> 16)) & 0x0000FFFF0000FFFF;
+  return ((val << 16) | (val >> 32)) & 0xFFFFFFFF;
+}
+
+inline uint64_t parseDecimal(const char* digits, size_t len) {
+  uint64_t val = 0;
+  for (; len >= 8; digits += 8, len -= 8) val = val * 100000000 + parseDecimal8(digits);
+  for (; len; ++digits, --len) val = val * 10 + (*digits - '0');
+  return val;
+}
+
+inline uint64_t parseHex(const char* digits, size_t len) {
+  uint64_t val = 0;
+  for (; len >= 8; digits += 8, len -= 8) val = (val << 32) | parseHex8(digits);
+  for (; len; ++digits, --len) val = (val << 4) | ((*digits & 0xF) + (*digits >> 6) * 9);
+  return val;
+}
+
+/*
+Read-only mapping of a trace written by fp.h, either text ("id\naddr\n" records, addr printed with %p)
+or binary (FP_TRACE_BINARY_MAGIC then FpTraceRecord's). Records are decoded straight from the mapping,
+nothing is copied, so the same MappedTrace can be read by several threads at once.
+*/
+struct MappedTrace {
+  const char* data = nullptr;
+  uint64_t size = 0;
+  bool isBinary = false;
+
+  explicit MappedTrace(const std::string& tracePath) {
+    int fd = open(tracePath.c_str(), O_RDONLY);
+    struct stat traceStat;
+    if (fd < 0 || fstat(fd, &traceStat) != 0 || traceStat.st_size == 0) {
+      if (fd >= 0) close(fd);
+      return;
+    }
+    void* mapping = mmap(nullptr, traceStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return;
+    madvise(mapping, traceStat.st_size, MADV_SEQUENTIAL);
+    data = (const char*)mapping;
+    size = traceStat.st_size;
+    isBinary = size >= sizeof(FP_TRACE_BINARY_MAGIC) - 1
+      && std::memcmp(data, FP_TRACE_BINARY_MAGIC, sizeof(FP_TRACE_BINARY_MAGIC) - 1) == 0;
+  }
+
+  MappedTrace(const MappedTrace&) = delete;
+  MappedTrace& operator=(const MappedTrace&) = delete;
+
+  ~MappedTrace() {
+    if (data) munmap((void*)data, size);
+  }
+
+  /* Call callback(id, addr) for every record starting in [begin, end), so consecutive ranges of the file can be
+     handed to different threads and every record is seen exactly once */
+  template <typename CALLBACK_T>
+  void forEachRecord(uint64_t begin, uint64_t end, CALLBACK_T&& callback) const {
+    if (!data) return;
+    if (isBinary) forEachBinaryRecord(begin, end, callback);
+    else forEachTextRecord(begin, end, callback);
+  }
+
+private:
+  template <typename CALLBACK_T>
+  void forEachBinaryRecord(uint64_t begin, uint64_t end, CALLBACK_T& callback) const {
+    const uint64_t headerSize = sizeof(FP_TRACE_BINARY_MAGIC) - 1;
+    const uint64_t recordSize = sizeof(FpTraceRecord);
+    uint64_t firstRecord = begin <= headerSize ? 0 : (begin - headerSize + recordSize - 1) / recordSize;
+    uint64_t numRecords = (size - headerSize) / recordSize;
+    uint64_t lastRecord = end <= headerSize ? 0 : std::min(numRecords, (end - headerSize + recordSize - 1) / recordSize);
+
+    for (uint64_t i = firstRecord; i < lastRecord; ++i) {
+      FpTraceRecord record;
+      std::memcpy(&record, data + headerSize + i * recordSize, recordSize); // the mapping is only byte aligned after the header
+      callback((size_t)record.id, (uint64_t)record.addr);
+    }
+  }
+
+  // Offset of the '\n' ending the line starting at pos (or size if there is none)
+  uint64_t findLineEnd(uint64_t pos) const {
+    auto* newline = (const char*)std::memchr(data + pos, '\n', size - pos);
+    return newline ? newline - data : size;
+  }
+
+  static bool isAddrLine(const char* line, size_t len) {
+    return len > 0 && (line[0] == '(' || (len > 1 && line[1] == 'x')); // "(nil)" or "0x..."
+  }
+
+  // id line then address line, parsed in place. Returns false if the record is truncated
+  bool parseTextRecord(uint64_t& pos, size_t& id, uint64_t& addr) const {
+    uint64_t idEnd, addrEnd;
+#if defined(__SSE2__)
+    if (pos + 48 <= size) { // both newlines of a record are almost always within the next 32 bytes
+      const __m128i newlines = _mm_set1_epi8('\n');
+      uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + pos)), newlines))
+        | ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + pos + 16)), newlines)) << 16);
+      if (mask && (mask & (mask - 1))) {
+        idEnd = pos + __builtin_ctz(mask);
+        mask &= mask - 1;
+        addrEnd = pos + __builtin_ctz(mask);
+      }
+      else {
+        idEnd = findLineEnd(pos);
+        addrEnd = idEnd < size ? findLineEnd(idEnd + 1) : size;
+      }
+    }
+    else
+#endif
+    {
+      idEnd = findLineEnd(pos);
+      addrEnd = idEnd < size ? findLineEnd(idEnd + 1) : size;
+    }
+    if (addrEnd >= size) return false;
+
+    const char* addrLine = data + idEnd + 1;
+    id = parseDecimal(data + pos, idEnd - pos);
+    addr = addrLine[0] == '(' ? 0 : parseHex(addrLine + 2, addrEnd - idEnd - 3);
+    pos = addrEnd + 1;
+    return true;
+  }
+
+  template <typename CALLBACK_T>
+  void forEachTextRecord(uint64_t begin, uint64_t end, CALLBACK_T& callback) const {
+    uint64_t pos = begin;
+    if (begin > 0) { // we might be in the middle of a line, or on the address line of a record
+      pos = data[begin - 1] == '\n' ? begin : findLineEnd(begin) + 1;
+      if (pos < size) {
+        uint64_t lineEnd = findLineEnd(pos);
+        if (isAddrLine(data + pos, lineEnd - pos)) pos = lineEnd + 1;
+      }
+    }
+
+    size_t id;
+    uint64_t addr;
+    while (pos < end && pos < size && parseTextRecord(pos, id, addr)) {
+      callback(id, addr);
+    }
+  }
+};
+} // end of namespace fp583
+
+#endif /* _TRACE_READER_H_ */
@@ -0,0 +1,80 @@
+#ifndef _FIX_UP_COUNTERS_H_
+#define _FIX_UP_COUNTERS_H_
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace fp583 {
+
+/*
+How often each speculation check runs and branches to its fix-up, in the optimized program. Every site gets a
+{checks, hits} pair of counters, bumped right before its check branch (no branch of its own), which a constructor
+registers with _fixup_counts_register of fp.h, and fp.h writes fixups.log at exit. Checks of the same site share
+their counters (the reads of a tree with lazy fix-ups).
+A site is keyed by its pass, its function and the location ids (as in the alias profile) of the pairs it speculated
+don't alias, e.g. "fp_licmoptim:main:12-40,13-40", so the keys stay the same from one build of the program to the next
+*/
+struct FixUpCounters {
+  static constexpr const char* registerFuncName = "_fixup_counts_register";
+  static constexpr const char* ctorName = "fp583.fixup_counts.init";
+
+  static std::string getSiteKey(StringRef passName, const Function& f, const std::vector<std::pair<size_t, size_t>>& idPairs) {
+    std::string ret = (passName + ":" + f.getName() + ":").str();
+    for (size_t i = 0; i < idPairs.size(); ++i) {
+      if (i > 0) ret += ",";
+      ret += std::to_string(idPairs[i].first) + "-" + std::to_string(idPairs[i].second);
+    }
+    return ret;
+  }
+
+  // the constructor registering the sites, made on the first one
+  static Function* getRegisterCtor(Module& m) {
+    if (auto* ctor = m.getFunction(ctorName)) return ctor;
+    auto* ctor = Function::Create(FunctionType::get(Type::getVoidTy(m.getContext()), false), GlobalValue::InternalLinkage, ctorName, m);
+    ReturnInst::Create(m.getContext(), BasicBlock::Create(m.getContext(), "", ctor));
+    appendToGlobalCtors(m, ctor, 0);
+    return ctor;
+  }
+
+  // count a run of checkBranch, and a hit when it goes to the fix-up (its true successor)
+  static void countCheck(BranchInst* checkBranch, const std::string& key) {
+    auto& m = *checkBranch->getModule();
+    auto& ctx = m.getContext();
+    auto* countType = Type::getInt64Ty(ctx);
+    auto* countsType = ArrayType::get(countType, 2);
+    std::string countsName = "fp583.fixup_counts." + key;
+    auto* counts = m.getNamedGlobal(countsName);
+    bool newSite = !counts;
+    if (newSite) {
+      counts = new GlobalVariable(m, countsType, false, GlobalValue::PrivateLinkage, ConstantAggregateZero::get(countsType), countsName);
+    }
+
+    IRBuilder<> builder(checkBranch);
+    auto bump = [&](unsigned i, Value* inc) {
+      auto* count = builder.CreateConstInBoundsGEP2_32(countsType, counts, 0, i);
+      builder.CreateStore(builder.CreateAdd(builder.CreateLoad(countType, count), inc), count);
+    };
+    bump(0, ConstantInt::get(countType, 1));
+    bump(1, builder.CreateZExt(checkBranch->getCondition(), countType));
+    if (!newSite) return;
+
+    auto* ctor = getRegisterCtor(m);
+    IRBuilder<> ctorBuilder(ctor->getEntryBlock().getTerminator());
+    auto registerFunc = m.getOrInsertFunction(registerFuncName, Type::getVoidTy(ctx), ctorBuilder.getInt8PtrTy(), countType->getPointerTo());
+    auto* firstCount = ConstantExpr::getInBoundsGetElementPtr(countsType, counts, ArrayRef<Constant*>{ctorBuilder.getInt32(0), ctorBuilder.getInt32(0)});
+    ctorBuilder.CreateCall(registerFunc, {ctorBuilder.CreateGlobalStringPtr(key, "fp583.fixup_site"), firstCount});
+  }
+};
+} // end of namespace fp583
+
+#endif /* _FIX_UP_COUNTERS_H_ */
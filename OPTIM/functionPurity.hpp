@@ -0,0 +1,91 @@
+#ifndef _FUNCTION_PURITY_H_
+#define _FUNCTION_PURITY_H_
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+using namespace llvm;
+
+namespace fp583 {
+
+/*
+A function is pure when its result only depends on the values of its arguments, so 2 calls with the same arguments
+can be merged, and a call can be hoisted as long as its arguments are. That's the case of:
+  - functions named *_PURE_*, the programmer's word for it, whatever they do
+  - functions which don't touch memory according to their attributes (run opt -function-attrs first to get them on
+    optimized code, -O0 functions are optnone and left alone by it)
+  - the libm functions of numbers (their errno is ignored, as with -fno-math-errno)
+  - functions whose body only touches its own stack slots and constant globals, and only calls pure functions
+*/
+struct FunctionPurity {
+  std::unordered_map<const Function*, bool> functionToIsPure;
+
+  bool isPure(const Function* f) {
+    if (!f) return false; // indirect call
+    if (auto it = functionToIsPure.find(f); it != functionToIsPure.end()) return it->second;
+    functionToIsPure[f] = false; // recursive calls are taken as impure while f is looked at
+    bool ret = f->getName().contains("_PURE_") || hasPureAttributes(f) || isPureLibmFunction(f) || isBodyPure(f);
+    functionToIsPure[f] = ret;
+    return ret;
+  }
+
+  static bool hasPointerParams(const Function* f) {
+    for (auto& arg : f->args()) {
+      if (arg.getType()->isPtrOrPtrVectorTy()) return true;
+    }
+    return false;
+  }
+
+  // readnone, or only reading through pointer arguments it doesn't have
+  static bool hasPureAttributes(const Function* f) {
+    return f->doesNotAccessMemory() || (f->onlyReadsMemory() && f->onlyAccessesArgMemory() && !hasPointerParams(f));
+  }
+
+  static bool isPureLibmFunction(const Function* f) {
+    static const std::unordered_set<std::string> libmFunctions = {
+      "sqrt", "cbrt", "hypot", "pow", "exp", "exp2", "expm1", "log", "log2", "log10", "log1p",
+      "sin", "cos", "tan", "asin", "acos", "atan", "atan2", "sinh", "cosh", "tanh", "asinh", "acosh", "atanh",
+      "fabs", "floor", "ceil", "round", "trunc", "fmod", "fmin", "fmax", "copysign", "erf", "erfc"
+    };
+    if (!f->isDeclaration() || hasPointerParams(f) || !f->getReturnType()->isFloatingPointTy()) return false;
+    auto name = f->getName();
+    if (libmFunctions.count(name.str())) return true;
+    return (name.endswith("f") || name.endswith("l")) && libmFunctions.count(name.drop_back().str()); // float and long double versions
+  }
+
+  static bool isLocalOrConstant(const Value* ptr) {
+    auto* object = getUnderlyingObject(ptr);
+    auto* global = dyn_cast<GlobalVariable>(object);
+    return isa<AllocaInst>(object) || (global && global->isConstant());
+  }
+
+  bool isBodyPure(const Function* f) {
+    if (f->isDeclaration()) return false;
+    for (auto& inst : instructions(f)) {
+      if (auto* loadInst = dyn_cast<LoadInst>(&inst)) {
+        if (!loadInst->isSimple() || !isLocalOrConstant(loadInst->getPointerOperand())) return false;
+      }
+      else if (auto* storeInst = dyn_cast<StoreInst>(&inst)) {
+        if (!storeInst->isSimple() || !isLocalOrConstant(storeInst->getPointerOperand())) return false;
+      }
+      else if (auto* call = dyn_cast<CallBase>(&inst)) {
+        if (!isPure(call->getCalledFunction())) return false;
+        // a _PURE_ callee may read what its pointers point to, which has to be ours
+        for (auto& arg : call->args()) {
+          if (arg->getType()->isPtrOrPtrVectorTy() && !isLocalOrConstant(arg)) return false;
+        }
+      }
+      else if (inst.mayReadOrWriteMemory()) return false;
+    }
+    return true;
+  }
+};
+} // end of namespace fp583
+
+#endif /* _FUNCTION_PURITY_H_ */
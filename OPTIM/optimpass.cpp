@@ -3,6 +3,8 @@
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Format.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/ScopedHashTable.h"
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/BlockFrequencyInfo.h"
 #include "llvm/Analysis/BranchProbabilityInfo.h"
@@ -11,17 +13,32 @@
 #include "llvm/Analysis/LoopIterator.h"
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MustExecute.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Constants.h"
 
 #include "../ANALYSIS/analysispass.cpp"
+#include "functionPurity.hpp"
+#include "speculationCost.hpp"
+#include "fixUpCounters.hpp"
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <unordered_map>
 #include <fstream>
@@ -30,6 +47,28 @@
 
 using namespace llvm;
 
+static cl::opt<bool> UseCostModel("fp-cost-model", cl::init(true),
+  cl::desc("Speculate calls and hoist loads when the expected saving is positive, instead of on alias probability thresholds"));
+static cl::opt<double> MispredictCost("fp-mispredict-cost", cl::init(15.0),
+  cl::desc("Cycles lost to the branch to a fix-up when a speculation fails"));
+enum class FixUpStrategy { Eager, Lazy };
+static cl::opt<FixUpStrategy> LICMFixUps("fp-licm-fixups", cl::init(FixUpStrategy::Eager),
+  cl::desc("When fp_licmoptim redoes the hoisted values a store hit"),
+  cl::values(clEnumValN(FixUpStrategy::Eager, "eager", "in a fix-up right after the store"),
+             clEnumValN(FixUpStrategy::Lazy, "lazy", "the store sets a dirty flag, the values are redone where the loop reads them")));
+static cl::opt<bool> CountFixUps("fp-count-fixups", cl::init(false),
+  cl::desc("Count how often every speculation check branches to its fix-up, the program writes fixups.log at exit (needs fp.h)"));
+static cl::opt<unsigned> DespeculateAfter("fp-despeculate-after", cl::init(0),
+  cl::desc("fp_licmoptim keeps a copy of the loops it speculates in, run instead of them once their fix-ups ran this many times (0: no copy)"));
+static cl::opt<double> FuncCallsAliasThreshold("fp-funcoptim-threshold", cl::init(0.80),
+  cl::desc("fp_funcoptim without the cost model: speculate on args at least this likely to be the same"));
+static cl::opt<double> LICMAliasThreshold("fp-licmoptim-threshold", cl::init(0.02),
+  cl::desc("fp_licmoptim without the cost model: hoist past stores at most this likely to alias per iteration"));
+static cl::opt<double> LoadsAliasThreshold("fp-loadoptim-threshold", cl::init(0.02),
+  cl::desc("fp_loadoptim: reuse loads across stores at most this likely to alias"));
+static cl::opt<double> LoopVersioningAliasThreshold("fp-loopversion-threshold", cl::init(0.02),
+  cl::desc("fp_loopversion: version loops whose accesses are at most this likely to alias per iteration"));
+
 /*
 PLAN:
   - pure function optimization
@@ -41,28 +80,154 @@ https://stackoverflow.com/questions/10990018/how-to-generate-assembly-code-with-
 
 namespace {
 
-bool isFunctionPure(Function* f) {
-  return f->getName().contains("_PURE_");
+/* Fraction of the iterations of L in which the store hits the load's location. Falls back to the
+   whole-run collision ratio when the pair wasn't observed in enough iterations of L */
+fp583::AliasEstimate getIterationAliasEstimate(const fp583::InstLogAnalysis& instLogAnalysis, Loop* L, const MemoryLocation& loadLoc, const MemoryLocation& storeLoc) {
+  auto iterationEstimate = instLogAnalysis.getIterationAliasEstimate(L, loadLoc, storeLoc);
+  if (iterationEstimate.known) {
+    return iterationEstimate;
+  }
+  return instLogAnalysis.getAliasEstimate(loadLoc, storeLoc);
+}
+
+/* !prof weights of a check which branches to its fix-up (the true successor) with probability probaFixUp, as
+   profiled. Block placement then moves the fix-up out of the hot path, and BlockFrequencyInfo sees it as cold */
+MDNode* createFixUpWeights(LLVMContext& ctx, double probaFixUp) {
+  const double scale = 1 << 20;
+  auto toWeight = [scale](double proba) { return (uint32_t)std::max(1.0, std::round(std::clamp(proba, 0.0, 1.0) * scale)); };
+  return MDBuilder(ctx).createBranchWeights(toWeight(probaFixUp), toWeight(1.0 - probaFixUp));
+}
+
+// the calls a fix-up redoes are cold callsites, which hot/cold splitting outlines with their block
+void markColdInFixUp(Instruction* inst) {
+  if (auto* call = dyn_cast<CallBase>(inst)) call->addFnAttr(Attribute::Cold);
+}
+
+/* With -fp-count-fixups, count the runs of the check in front of fixUpBB and how often it branched to it, as the
+   site of the pairs of accesses it speculated don't alias */
+void countFixUps(const fp583::InstLogAnalysis& instLogAnalysis, StringRef passName, BasicBlock* fixUpBB, const std::vector<std::pair<Instruction*, Instruction*>>& speculatedPairs) {
+  if (!CountFixUps) return;
+  std::vector<std::pair<size_t, size_t>> idPairs;
+  for (auto& [inst1, inst2] : speculatedPairs) {
+    size_t id1 = (size_t)-1, id2 = (size_t)-1; // not profiled, can't happen as the pair was speculated on
+    instLogAnalysis.getLocationId(MemoryLocation::get(inst1), id1);
+    instLogAnalysis.getLocationId(MemoryLocation::get(inst2), id2);
+    idPairs.push_back({id1, id2});
+  }
+  auto* checkBranch = cast<BranchInst>(fixUpBB->getSinglePredecessor()->getTerminator());
+  fp583::FixUpCounters::countCheck(checkBranch, fp583::FixUpCounters::getSiteKey(passName, *fixUpBB->getParent(), idPairs));
+}
+
+/* true when storeInst writes some of the bytes loadInst reads at loadPtr (its pointer operand, or what stands for it
+   once hoisted), whatever their types. Accesses of the same size aligned to it are either at the same address or
+   disjoint, comparing the pointers is enough for them */
+Value* generateOverlapICmp(IRBuilder<>& builder, LoadInst* loadInst, Value* loadPtr, StoreInst* storeInst) {
+  auto& DL = loadInst->getModule()->getDataLayout();
+  uint64_t loadSize = DL.getTypeStoreSize(loadInst->getType());
+  uint64_t storeSize = DL.getTypeStoreSize(storeInst->getValueOperand()->getType());
+  auto* loadBytePtr = builder.CreatePointerCast(loadPtr, builder.getInt8PtrTy());
+  auto* storeBytePtr = builder.CreatePointerCast(storeInst->getPointerOperand(), builder.getInt8PtrTy());
+  if (loadSize == storeSize && isPowerOf2_64(loadSize) && loadInst->getAlign().value() >= loadSize && storeInst->getAlign().value() >= storeSize) {
+    return builder.CreateICmpEQ(storeBytePtr, loadBytePtr);
+  }
+  auto* storeBeforeEndOfLoad = builder.CreateICmpULT(storeBytePtr, builder.CreateConstGEP1_64(builder.getInt8Ty(), loadBytePtr, loadSize));
+  auto* loadBeforeEndOfStore = builder.CreateICmpULT(loadBytePtr, builder.CreateConstGEP1_64(builder.getInt8Ty(), storeBytePtr, storeSize));
+  return builder.CreateAnd(storeBeforeEndOfLoad, loadBeforeEndOfStore);
+}
+
+/* Replace ogInst by speculatedVal, and redo ogInst in a fix-up block when the speculation failed (with probability
+   probaMisspeculated):
+     currBB:      ...  br misspeculated, fixUpBB, followingBB, !prof
+     fixUpBB:     ogInst'  br followingBB
+     followingBB: phi [speculatedVal, currBB], [ogInst', fixUpBB]  ...
+   returns fixUpBB */
+BasicBlock* replaceWithFixUp(Instruction* ogInst, Value* speculatedVal, Value* misspeculated, double probaMisspeculated) {
+  auto* currBB = ogInst->getParent();
+  auto* followingBB = currBB->splitBasicBlock(ogInst);
+  currBB->getInstList().back().eraseFromParent(); // erase unconditional branch added by splitBasicBlock
+
+  auto* f = currBB->getParent();
+  auto* fixUpBB = BasicBlock::Create(f->getContext(), "", f);
+  auto* condCheckToFixUpBranch = BranchInst::Create(fixUpBB, followingBB, misspeculated, currBB);
+  condCheckToFixUpBranch->setMetadata(LLVMContext::MD_prof, createFixUpWeights(f->getContext(), probaMisspeculated));
+  auto* fixUpEndBranch = BranchInst::Create(followingBB, fixUpBB);
+
+  auto* instInFixUp = ogInst->clone();
+  instInFixUp->insertBefore(fixUpBB->getTerminator());
+  markColdInFixUp(instInFixUp);
+
+  if (!ogInst->getType()->isVoidTy()) {
+    auto* phiNode = PHINode::Create(ogInst->getType(), 2, "", ogInst);
+    phiNode->addIncoming(speculatedVal, currBB);
+    phiNode->addIncoming(instInFixUp, fixUpBB);
+    ogInst->replaceAllUsesWith(phiNode);
+  }
+
+  ogInst->eraseFromParent();
+  return fixUpBB;
+}
+
+/* Clone L behind a branch on conflict in its preheader, returns the clone (taken on conflict). L has to be in
+   simplified and LCSSA form, with a single exit block */
+Loop* versionLoop(Loop* L, Value* conflict, LoopInfo& LI, DominatorTree& DT) {
+  auto* checkBB = L->getLoopPreheader();
+  auto* exitBB = L->getExitBlock();
+  auto* fastPH = SplitBlock(checkBB, checkBB->getTerminator(), &DT, &LI, nullptr, L->getHeader()->getName() + ".fast.ph");
+
+  ValueToValueMapTy vmap;
+  SmallVector<BasicBlock*, 8> slowBlocks;
+  auto* slowLoop = cloneLoopWithPreheader(fastPH, checkBB, L, vmap, ".slow", &LI, &DT, slowBlocks);
+  remapInstructionsInBlocks(slowBlocks, vmap);
+
+  auto* checkBranch = checkBB->getTerminator(); // the jump to fastPH added by SplitBlock
+  BranchInst::Create(cast<BasicBlock>(vmap[fastPH]), fastPH, conflict, checkBranch);
+  checkBranch->eraseFromParent();
+  DT.changeImmediateDominator(exitBB, checkBB);
+
+  // the exit is now reached from both loops, values coming out of L come out of its copy too
+  for (auto& phi : exitBB->phis()) {
+    for (unsigned i = 0, numIncoming = phi.getNumIncomingValues(); i < numIncoming; ++i) {
+      auto* incomingBB = phi.getIncomingBlock(i);
+      if (!L->contains(incomingBB)) continue;
+      Value* slowIncoming = phi.getIncomingValue(i);
+      if (auto it = vmap.find(slowIncoming); it != vmap.end()) slowIncoming = it->second;
+      phi.addIncoming(slowIncoming, cast<BasicBlock>(vmap[incomingBB]));
+    }
+  }
+
+  formDedicatedExitBlocks(L, &DT, &LI, nullptr, true);
+  formDedicatedExitBlocks(slowLoop, &DT, &LI, nullptr, true);
+  return slowLoop;
 }
 
 struct FuncCallsAliasProfilePass : public ModulePass {
   static char ID;
-  double aliasProbaThreshold = 0.80;
+  double aliasProbaThreshold = FuncCallsAliasThreshold; // without the cost model
+  fp583::FunctionPurity functionPurity;
+  fp583::SpeculationCostModel costModel;
+
+  // pure calls of the blocks dominating the current one, keyed by getCallKey
+  using CallTable = ScopedHashTable<size_t, CallBase*>;
+
+  struct CallReplacement {
+    CallBase* call;
+    CallBase* prevCall; // dominates call
+    std::vector<std::pair<Value*, Value*>> ptrArgsVals; // empty when the calls are identical for sure
+    double probaDifferent; // that the fix-up runs
+  };
 
   FuncCallsAliasProfilePass() : ModulePass(ID) {}
 
   void getAnalysisUsage(AnalysisUsage& AU) const override {
     AU.addRequired<fp583::InstLogAnalysisWrapperPass>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
   }
 
-  MemoryLocation getMemLocFromPtr(const Value* val) {
-    return MemoryLocation(val); // TOCHECK: this is jank (this should work bc analysis just looks at ptr value but in practice it's bad style)
-  }
-
-  bool areFunctionCallsIdentical(const fp583::InstLogAnalysis& instLogAnalysis, CallBase* call1, CallBase* call2, std::vector<std::pair<Value*, Value*>>& ptrArgsVals){
+  bool areFunctionCallsIdentical(const fp583::InstLogAnalysis& instLogAnalysis, CallBase* call1, CallBase* call2, std::vector<std::pair<Value*, Value*>>& ptrArgsVals, double& probaDifferent){
     assert(call1->getCalledFunction() == call2->getCalledFunction());
     auto* calledF = call1->getCalledFunction();
-    assert(calledF->getName().contains("_PURE_") && "function name contains PURE");
+    probaDifferent = 0.0; // union bound over the args
 
     for (unsigned int i = 0; i < calledF->arg_size(); ++i) {
       auto* arg = calledF->getArg(i);
@@ -71,27 +236,49 @@ struct FuncCallsAliasProfilePass : public ModulePass {
 
 
       if (val1 == val2) {
-        return true;
+        continue;
       }
-      else if (auto* loadInst1 = dyn_cast<LoadInst>(val1), *loadInst2 = dyn_cast<LoadInst>(val2); loadInst1 && loadInst2) {
+      // the fix-up compares scalars only
+      else if (auto* loadInst1 = dyn_cast<LoadInst>(val1), *loadInst2 = dyn_cast<LoadInst>(val2);
+               loadInst1 && loadInst2 && (arg->getType()->isIntOrPtrTy() || arg->getType()->isFloatingPointTy())) {
         auto memLoc1 = MemoryLocation::get(loadInst1), memLoc2 = MemoryLocation::get(loadInst2);
-        double probaAlias = instLogAnalysis.getAliasProbability(memLoc1, memLoc2);
-        if (probaAlias < aliasProbaThreshold) {
+        auto aliasEstimate = instLogAnalysis.getAliasEstimate(memLoc1, memLoc2);
+        if (!aliasEstimate.known || (!UseCostModel && aliasEstimate.lower < aliasProbaThreshold)) {
           return false;
         }
+        probaDifferent += 1.0 - aliasEstimate.probability;
         ptrArgsVals.push_back({val1, val2});
       }
       else return false;
     }
-    return true;
+    probaDifferent = std::min(probaDifferent, 1.0);
+    return ptrArgsVals.empty() || !UseCostModel || getSpeculationSaving(call1, ptrArgsVals, probaDifferent) > 0.0;
+  }
+
+  /* Expected cycles saved per run of call's block by reusing the result of the earlier call. The check and the
+     fix-up are in call's block, so its frequency doesn't change the sign, and the fix-up only redoes the call */
+  double getSpeculationSaving(CallBase* call, const std::vector<std::pair<Value*, Value*>>& ptrArgsVals, double probaDifferent) {
+    std::vector<Type*> comparedTypes;
+    for (auto& [val1, val2] : ptrArgsVals) comparedTypes.push_back(val1->getType());
+    double callCost = costModel.getInstCost(call);
+    double checkCost = costModel.getCheckCost(*call->getFunction(), comparedTypes);
+    return (1.0 - probaDifferent) * callCost - checkCost - probaDifferent * costModel.mispredictCost;
   }
 
  
 
 
+  /* Numbers are compared bit for bit: fcmp would take -0.0 and 0.0 for the same (sqrt doesn't), and NaNs for
+     different */
   Instruction* generateFixUpICmp(CallBase* ogCall, const std::vector<std::pair<Value*, Value*>>& ptrArgsVals) {
+    auto& DL = ogCall->getModule()->getDataLayout();
     Instruction* lastComp = nullptr;
-    for (auto& [val1, val2] : ptrArgsVals) {
+    for (auto [val1, val2] : ptrArgsVals) {
+      if (val1->getType()->isFloatingPointTy()) {
+        auto* bitsType = IntegerType::get(ogCall->getContext(), DL.getTypeSizeInBits(val1->getType()));
+        val1 = new BitCastInst(val1, bitsType, "", ogCall);
+        val2 = new BitCastInst(val2, bitsType, "", ogCall);
+      }
       auto* valComp = new ICmpInst(ogCall, ICmpInst::ICMP_NE, val1, val2);
       if (lastComp) {
         lastComp = BinaryOperator::CreateOr(valComp, lastComp);
@@ -105,31 +292,47 @@ struct FuncCallsAliasProfilePass : public ModulePass {
     return lastComp;
   }
 
-  /* returns fixUpBB so we can exclude it from our optimization pass (would loop forever otherwise) */
-  BasicBlock* removeFunctionCallAndFixUp(CallBase* ogCall, CallBase* prevCall, const std::vector<std::pair<Value*, Value*>>& ptrArgsVals) {
+  BasicBlock* removeFunctionCallAndFixUp(CallBase* ogCall, CallBase* prevCall, const std::vector<std::pair<Value*, Value*>>& ptrArgsVals, double probaDifferent) {
     Instruction* lastComp = generateFixUpICmp(ogCall, ptrArgsVals);
+    return replaceWithFixUp(ogCall, prevCall, lastComp, probaDifferent);
+  }
 
-    auto* currBB = ogCall->getParent();
-    auto* followingBB = currBB->splitBasicBlock(ogCall);
-    currBB->getInstList().back().eraseFromParent(); // erase unconditional branch added by splitBasicBlock
+  /* The callee and the arguments which have to be the same values, loaded arguments can differ as
+     areFunctionCallsIdentical may speculate them equal */
+  size_t getCallKey(CallBase* call) {
+    hash_code ret = hash_value(call->getCalledFunction());
+    for (auto& arg : call->args()) {
+      ret = hash_combine(ret, isa<LoadInst>(arg) ? nullptr : arg.get());
+    }
+    return (size_t)ret >> 1; // clear of the empty and tombstone keys of DenseMapInfo<size_t>
+  }
 
-    auto* f = currBB->getParent();
-    auto* fixUpBB = BasicBlock::Create(f->getContext(), "", f);
-    auto* condCheckToFixUpBranch = BranchInst::Create(fixUpBB, followingBB, lastComp, currBB);
-    auto* fixUpEndBranch = BranchInst::Create(followingBB, fixUpBB);
+  /* Pure calls of the block which an earlier call of a dominating block (or of the block) can replace, then the same
+     for the blocks it dominates. The calls which stay are seen by those blocks only */
+  void collectCallReplacements(const fp583::InstLogAnalysis& instLogAnalysis, DomTreeNode* node, CallTable& prevCalls, std::vector<CallReplacement>& replacements) {
+    CallTable::ScopeTy scope(prevCalls);
 
-    auto* callInFixUp = ogCall->clone();
-    callInFixUp->insertBefore(fixUpBB->getTerminator());
+    for (auto& inst : *node->getBlock()) {
+      auto* currCall = dyn_cast<CallBase>(&inst);
+      if (!currCall || !functionPurity.isPure(currCall->getCalledFunction())) continue;
 
-    if (!ogCall->getType()->isVoidTy()) {
-      auto* phiNode = PHINode::Create(ogCall->getType(), 2, "", ogCall);
-      phiNode->addIncoming(prevCall, currBB);
-      phiNode->addIncoming(callInFixUp, fixUpBB);
-      ogCall->replaceAllUsesWith(phiNode);
+      size_t key = getCallKey(currCall);
+      bool callReplaced = false;
+      for (auto it = prevCalls.begin(key); it != prevCalls.end() && !callReplaced; ++it) {
+        auto* prevCall = *it;
+        std::vector<std::pair<Value*, Value*>> ptrArgsVals;
+        double probaDifferent;
+        if (prevCall->getCalledFunction() == currCall->getCalledFunction() && areFunctionCallsIdentical(instLogAnalysis, currCall, prevCall, ptrArgsVals, probaDifferent)) {
+          replacements.push_back({currCall, prevCall, std::move(ptrArgsVals), probaDifferent});
+          callReplaced = true;
+        }
+      }
+      if (!callReplaced) prevCalls.insert(key, currCall);
     }
 
-    ogCall->eraseFromParent();
-    return fixUpBB;
+    for (auto* child : *node) {
+      collectCallReplacements(instLogAnalysis, child, prevCalls, replacements);
+    }
   }
 
   /* example:
@@ -140,57 +343,37 @@ struct FuncCallsAliasProfilePass : public ModulePass {
     //    --> fn(val1, ptrB);
     //   fn(val2, ptrB);
   */
-  /* do actual optimizations */
+  /* do actual optimizations, the replacements are all found before the fix-ups split any block */
   bool handleFunction(const fp583::InstLogAnalysis& instLogAnalysis, Function& f) {
-    bool changed = false;
-    std::unordered_map<Function*, std::vector<CallBase*>> prevFunctionCalls;
-    std::unordered_set<BasicBlock*> fixUpBBs; /* We need to avoid fixUpBBs we introduce as
-    they contain calls that can be optimized (otherwise they wouldn't be in fixUp) and if we don't avoid
-    them, our loop over BBs goes forever */
-
-    for (auto& bb : f) {
-      if (fixUpBBs.count(&bb)) {
-        fixUpBBs.erase(&bb);
-        continue;
-      }
+    if (f.isDeclaration()) return false;
+    auto& DT = getAnalysis<DominatorTreeWrapperPass>(f).getDomTree();
+    CallTable prevCalls;
+    std::vector<CallReplacement> replacements;
+    collectCallReplacements(instLogAnalysis, DT.getRootNode(), prevCalls, replacements);
 
-      auto* nextInst = &bb.getInstList().front();
-      while (auto* inst = nextInst) {
-        nextInst = inst->getNextNode();
-
-        if (auto* currCall = dyn_cast<CallBase>(inst)) {
-          auto* fCalled = currCall->getCalledFunction();
-          if (!isFunctionPure(fCalled)) continue;
-
-          bool callNotDeleted = true;
-          if (prevFunctionCalls.count(fCalled)) {
-            auto& prevCallsVec = prevFunctionCalls[fCalled];
-            for (auto* prevCall : prevCallsVec) {
-              std::vector<std::pair<Value*, Value*>> ptrArgsVals;
-
-              // check !ptrArgsVals.empty() to limit scope to only calls with ptr input
-              if (areFunctionCallsIdentical(instLogAnalysis, currCall, prevCall, ptrArgsVals) && !ptrArgsVals.empty()) {
-                auto* fixUpBB = removeFunctionCallAndFixUp(currCall, prevCall, ptrArgsVals);
-                fixUpBBs.insert(fixUpBB);
-                changed = true;
-                callNotDeleted = false;
-                break;
-              }
-            }
-          }
-
-          if (callNotDeleted) prevFunctionCalls[fCalled].push_back(currCall);
-          else break;
-        }
+    for (auto& [call, prevCall, ptrArgsVals, probaDifferent] : replacements) {
+      if (ptrArgsVals.empty()) {
+        call->replaceAllUsesWith(prevCall);
+        call->eraseFromParent();
+      }
+      else {
+        std::vector<std::pair<Instruction*, Instruction*>> speculatedPairs;
+        for (auto& [val1, val2] : ptrArgsVals) speculatedPairs.push_back({cast<Instruction>(val1), cast<Instruction>(val2)});
+        auto* fixUpBB = removeFunctionCallAndFixUp(call, prevCall, ptrArgsVals, probaDifferent);
+        countFixUps(instLogAnalysis, "fp_funcoptim", fixUpBB, speculatedPairs);
       }
     }
 
-    return changed;
+    return !replacements.empty();
   }
 
   bool runOnModule(Module &m) override {
     bool changed = false;
     auto& instLogAnalysis = getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis();
+    costModel.getTTI = [this](Function& f) -> const TargetTransformInfo& {
+      return getAnalysis<TargetTransformInfoWrapperPass>().getTTI(f);
+    };
+    costModel.mispredictCost = MispredictCost;
 
     for (auto& f : m) {
       changed |= handleFunction(instLogAnalysis, f);
@@ -201,6 +384,139 @@ struct FuncCallsAliasProfilePass : public ModulePass {
 }; // end of struct OptOnAliasProfilePass
 
 
+/* ****************************************************************** */
+
+// REDUNDANT LOADS PASS
+
+/* ****************************************************************** */
+
+
+/*
+  Reuse the value of an earlier load of the same pointer in the block when the stores in between are unlikely to
+  write there, and check them right before the reload, in the style of FuncCallsAliasProfilePass:
+    x = *p; *q = y; z = *p;   -->   x = *p; *q = y; z = (q overlaps p) ? *p : x;
+  Stores likely to alias and calls which may write to memory make the earlier values unavailable.
+*/
+struct RedundantLoadsAliasProfilePass : public FunctionPass {
+  static char ID;
+  double aliasProbaThreshold = LoadsAliasThreshold;
+
+  // value of an earlier load, and the stores since then which might have changed it
+  struct AvailableLoad {
+    LoadInst* loadInst;
+    Value* ptr; // pointer operand of loadInst, through loads it is known to equal
+    Value* val;
+    std::vector<StoreInst*> speculatedStores;
+  };
+
+  RedundantLoadsAliasProfilePass() : FunctionPass(ID) {}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override {
+    AU.addRequired<AAResultsWrapperPass>();
+    AU.addRequired<fp583::InstLogAnalysisWrapperPass>();
+  }
+
+  /* false if storeInst may have written to what loadInst read, tells whether the value is speculated from then on */
+  bool isStillAvailable(const fp583::InstLogAnalysis& instLogAnalysis, AAResults& aliasResults, LoadInst* loadInst, StoreInst* storeInst, bool& speculated) {
+    auto loadLoc = MemoryLocation::get(loadInst), storeLoc = MemoryLocation::get(storeInst);
+    auto aliasResult = aliasResults.alias(loadLoc, storeLoc);
+    speculated = aliasResult == AliasResult::MayAlias;
+    if (aliasResult == AliasResult::NoAlias) return true;
+    if (!speculated || loadInst->getPointerAddressSpace() != 0 || storeInst->getPointerAddressSpace() != 0) return false;
+    auto aliasEstimate = instLogAnalysis.getAliasEstimate(loadLoc, storeLoc);
+    return aliasEstimate.known && aliasEstimate.upper <= aliasProbaThreshold;
+  }
+
+  // true when one of the stores wrote some of the bytes loadInst reads
+  Value* generateFixUpICmp(LoadInst* loadInst, const std::vector<StoreInst*>& speculatedStores) {
+    IRBuilder<> builder(loadInst);
+    Value* lastComp = nullptr;
+    for (auto* storeInst : speculatedStores) {
+      auto* comp = generateOverlapICmp(builder, loadInst, loadInst->getPointerOperand(), storeInst);
+      lastComp = lastComp ? builder.CreateOr(comp, lastComp) : comp;
+    }
+    return lastComp;
+  }
+
+  // that one of the stores wrote to what loadInst read, union bound
+  double getProbaHit(const fp583::InstLogAnalysis& instLogAnalysis, LoadInst* loadInst, const std::vector<StoreInst*>& speculatedStores) {
+    double ret = 0.0;
+    for (auto* storeInst : speculatedStores) {
+      ret += instLogAnalysis.getAliasEstimate(MemoryLocation::get(loadInst), MemoryLocation::get(storeInst)).probability;
+    }
+    return std::min(ret, 1.0);
+  }
+
+  bool handleBlock(const fp583::InstLogAnalysis& instLogAnalysis, AAResults& aliasResults, BasicBlock* bb) {
+    bool changed = false;
+    std::vector<AvailableLoad> availableLoads;
+    /* Reloads with nothing to speculate on are left to GVN, but they are the same value as the first load: at -O0
+       every *p reloads p from its stack slot, p's loads have to be seen as one value for the loads of *p to match */
+    std::unordered_map<Value*, Value*> redundantToAvailable;
+    auto getAvailable = [&](Value* val) {
+      auto it = redundantToAvailable.find(val);
+      return it == redundantToAvailable.end() ? val : it->second;
+    };
+
+    // the fix-ups split the block, the scan goes on in the part after the reload
+    auto* nextInst = &bb->front();
+    while (auto* inst = nextInst) {
+      nextInst = inst->getNextNode();
+
+      if (auto* loadInst = dyn_cast<LoadInst>(inst); loadInst && loadInst->isSimple()) {
+        auto* ptr = getAvailable(loadInst->getPointerOperand());
+        auto it = llvm::find_if(availableLoads, [loadInst, ptr](auto& availableLoad) {
+          return availableLoad.ptr == ptr && availableLoad.loadInst->getType() == loadInst->getType();
+        });
+        if (it == availableLoads.end()) {
+          availableLoads.push_back({loadInst, ptr, loadInst, {}});
+        }
+        else if (it->speculatedStores.empty()) {
+          redundantToAvailable[loadInst] = it->val;
+        }
+        else {
+          auto* fixUpBB = replaceWithFixUp(loadInst, it->val, generateFixUpICmp(loadInst, it->speculatedStores),
+                                           getProbaHit(instLogAnalysis, it->loadInst, it->speculatedStores));
+          std::vector<std::pair<Instruction*, Instruction*>> speculatedPairs;
+          for (auto* storeInst : it->speculatedStores) speculatedPairs.push_back({it->loadInst, storeInst});
+          countFixUps(instLogAnalysis, "fp_loadoptim", fixUpBB, speculatedPairs);
+          it->val = &fixUpBB->getSingleSuccessor()->front(); // the phi of the reused and reloaded values
+          it->speculatedStores.clear();
+          changed = true;
+        }
+      }
+      else if (auto* storeInst = dyn_cast<StoreInst>(inst); storeInst && storeInst->isSimple()) {
+        llvm::erase_if(availableLoads, [&](auto& availableLoad) {
+          bool speculated;
+          if (!isStillAvailable(instLogAnalysis, aliasResults, availableLoad.loadInst, storeInst, speculated)) return true;
+          if (speculated) availableLoad.speculatedStores.push_back(storeInst);
+          return false;
+        });
+      }
+      else if (inst->mayWriteToMemory()) { // pure calls too, a _PURE_ name is about the result, they may still write
+        availableLoads.clear();
+      }
+    }
+
+    return changed;
+  }
+
+  bool runOnFunction(Function& f) override {
+    auto& instLogAnalysis = getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis();
+    auto& aliasResults = getAnalysis<AAResultsWrapperPass>().getAAResults();
+    bool changed = false;
+
+    std::vector<BasicBlock*> ogBBs; // not the blocks handleBlock splits off
+    for (auto& bb : f) ogBBs.push_back(&bb);
+    for (auto* bb : ogBBs) {
+      changed |= handleBlock(instLogAnalysis, aliasResults, bb);
+    }
+
+    return changed;
+  }
+}; // end of struct RedundantLoadsAliasProfilePass
+
+
 /* ****************************************************************** */
 
 // LICM PASS
@@ -210,7 +526,9 @@ struct FuncCallsAliasProfilePass : public ModulePass {
 
 struct LICMAliasProfilePass : public LoopPass {
   static char ID;
-  double aliasProbaThreshold = 0.02;
+  double aliasProbaThreshold = LICMAliasThreshold; // without the cost model
+  fp583::FunctionPurity functionPurity;
+  fp583::SpeculationCostModel costModel;
 
   LICMAliasProfilePass() : LoopPass(ID) {}
 
@@ -218,6 +536,7 @@ struct LICMAliasProfilePass : public LoopPass {
     AU.addRequired<LoopInfoWrapperPass>();
     AU.addRequired<fp583::InstLogAnalysisWrapperPass>();
     AU.addRequired<AAResultsWrapperPass>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
   }
 
   template <typename INST_T, typename BB_CONTAINER_T>
@@ -229,149 +548,685 @@ struct LICMAliasProfilePass : public LoopPass {
   }
 
 
-  /*
-    Return a map from mostly invariant loads to stores which might alias with them
-    Loads which are statically determined to be completely or never invariant are not returned
-  */
-  std::map<LoadInst*, std::vector<StoreInst*>> getMostlyInvariantLoads(Loop *L) {
+  // unprofiled pairs are as good as aliasing, hoisting them would only buy fix-ups
+  bool isTooLikelyToAlias(const fp583::InstLogAnalysis& instLogAnalysis, Loop* L, const MemoryLocation& loadLoc, const MemoryLocation& storeLoc) {
+    auto aliasEstimate = getIterationAliasEstimate(instLogAnalysis, L, loadLoc, storeLoc);
+    return !aliasEstimate.known || (!UseCostModel && aliasEstimate.upper > aliasProbaThreshold);
+  }
+
+  /* Loop invariant expression trees, except that some stores of the loop may hit their loads, e.g.
+       sqrt(*A_val_ptr * scale) + fn_PURE_(**ptrs, n)
+     The preheader computes them once, and a store which hits one of their loads redoes that load and what depends
+     on it in a fix-up right after the store. Those (mutable) values reach the loop through phis of the preheader
+     and fix-up definitions */
+  struct InvariantTrees {
+    std::vector<Instruction*> insts; // operands first
+    std::unordered_set<Instruction*> instSet;
+    std::unordered_map<LoadInst*, std::vector<StoreInst*>> loadToStores; // only the loads some stores may hit
+    std::unordered_set<Instruction*> mutableInsts; // those loads and what depends on them
+    std::unordered_map<Instruction*, Value*> instToPreheaderVal; // filled when hoisting
+    std::unordered_map<Instruction*, std::vector<Instruction*>> instToRecomputed; // by the fix-ups, of the mutable insts
+    GlobalVariable* misspeculations = nullptr; // runs of the fix-ups, with -fp-despeculate-after
+
+    bool contains(Value* val) const {
+      auto* inst = dyn_cast<Instruction>(val);
+      return inst && instSet.count(inst);
+    }
+  };
+
+  bool isHoistable(Instruction* inst) {
+    if (auto* loadInst = dyn_cast<LoadInst>(inst)) return loadInst->isSimple();
+    if (auto* call = dyn_cast<CallBase>(inst)) {
+      // a pure call reading through pointer args would depend on more memory than the loads we check
+      return !isa<DbgInfoIntrinsic>(call) && !call->getType()->isVoidTy() && functionPurity.isPure(call->getCalledFunction())
+          && llvm::none_of(call->args(), [](const Use& arg) { return arg->getType()->isPtrOrPtrVectorTy(); });
+    }
+    return !isa<PHINode>(inst) && !isa<AllocaInst>(inst) && !inst->mayReadOrWriteMemory() && isSafeToSpeculativelyExecute(inst);
+  }
+
+  /* The preheader runs inst on every entry of the loop, also when the loop wouldn't have: under a condition, or with
+     no iteration. So inst either runs anyway once the loop is entered, or can't trap (if (p) s += *p; with p null) */
+  bool isSafeToHoist(Loop* L, Instruction* inst, const DominatorTree& DT, const LoopSafetyInfo& safetyInfo) {
+    if (safetyInfo.isGuaranteedToExecute(*inst, &DT, L)) return true;
+    auto* preheaderEnd = L->getLoopPreheader()->getTerminator();
+    if (auto* loadInst = dyn_cast<LoadInst>(inst)) {
+      return isDereferenceableAndAlignedPointer(loadInst->getPointerOperand(), loadInst->getType(), loadInst->getAlign(),
+                                                loadInst->getModule()->getDataLayout(), preheaderEnd, &DT);
+    }
+    return isSafeToSpeculativelyExecute(inst, preheaderEnd, &DT); // pure calls may divide by 0 too
+  }
+
+  /* Fill dependentStores with the stores which may hit loadInst, false if one of them (or another write of the
+     loop, which the profile knows nothing about) is too likely to */
+  bool getDependentStores(Loop* L, LoadInst* loadInst, const std::vector<StoreInst*>& allStores, const std::vector<Instruction*>& otherWrites, std::vector<StoreInst*>& dependentStores) {
     auto& instLogAnalysis = getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis();
     auto& aliasResults = getAnalysis<AAResultsWrapperPass>().getAAResults();
-    std::map<LoadInst*, std::vector<StoreInst*>> hoistLoadsToStores;
-
-    // Collect all stores
-    auto allStores = std::vector<StoreInst*>{};
-    forEachInstOfType<StoreInst>(L->getBlocks(), [&allStores](auto* storeInst){ allStores.push_back(storeInst); });
-    // All loads map to all stores initially
-    forEachInstOfType<LoadInst>(L->getBlocks(), [this, L, &hoistLoadsToStores, &allStores](auto* loadInst){
-      auto* ptrOp = loadInst->getPointerOperand();
-      auto* loadOp = dyn_cast<LoadInst>(ptrOp);
-      // check if pointer is invariant, if result from a load, check if it'll be hoisted
-      if (loadOp && hoistLoadsToStores.count(loadOp) || L->isLoopInvariant(ptrOp)) {
-        hoistLoadsToStores[loadInst] = allStores; 
-      }
+    auto loadLoc = MemoryLocation::get(loadInst);
+
+    for (auto* inst : otherWrites) {
+      if (isModSet(aliasResults.getModRefInfo(inst, loadLoc))) return false;
+    }
+    for (auto* storeInst : allStores) {
+      auto storeLoc = MemoryLocation::get(storeInst);
+      // stores of other types may hit the load as well (type punning), the checks compare the bytes
+      if (aliasResults.isNoAlias(loadLoc, storeLoc)) continue;
+      if (aliasResults.isMustAlias(loadLoc, storeLoc) || isTooLikelyToAlias(instLogAnalysis, L, loadLoc, storeLoc)) return false;
+      dependentStores.push_back(storeInst);
+    }
+    return true;
+  }
+
+  InvariantTrees getInvariantTrees(Loop* L, LoopInfo* LI) {
+    InvariantTrees ret;
+    std::vector<StoreInst*> allStores;
+    std::vector<Instruction*> otherWrites; // calls and such, pure ones too: a _PURE_ name is about the result, they may still write
+    forEachInstOfType<Instruction>(L->getBlocks(), [&allStores, &otherWrites](auto* inst) {
+      if (auto* storeInst = dyn_cast<StoreInst>(inst)) allStores.push_back(storeInst);
+      else if (inst->mayWriteToMemory()) otherWrites.push_back(inst);
     });
 
-    // Remove any loads which must-alias with any stores, or which are too likely to alias
-    for (auto it = begin(hoistLoadsToStores); it != end(hoistLoadsToStores); ) {
-      if (llvm::any_of(it->second, [&](auto* storeInst) {
-        auto memLoc1 = MemoryLocation::get(it->first), memLoc2 = MemoryLocation::get(storeInst);
-        return aliasResults.isMustAlias(memLoc1, memLoc2) || instLogAnalysis.getAliasProbability(memLoc1, memLoc2) > aliasProbaThreshold;
-      })) {
-        it = hoistLoadsToStores.erase(it);
+    DominatorTree DT(*L->getHeader()->getParent()); // the fix-ups of the loops done before changed the CFG
+    SimpleLoopSafetyInfo safetyInfo;
+    safetyInfo.computeLoopSafetyInfo(L);
+
+    // in reverse post-order, operands come before the insts using them
+    LoopBlocksRPO blocksRPO(L);
+    blocksRPO.perform(LI);
+    for (auto* bb : blocksRPO) {
+      for (auto& inst : *bb) {
+        if (!isHoistable(&inst) || !llvm::all_of(inst.operands(), [&](const Use& op) { return L->isLoopInvariant(op) || ret.contains(op); })
+            || !isSafeToHoist(L, &inst, DT, safetyInfo)) {
+          continue;
+        }
+        auto* loadInst = dyn_cast<LoadInst>(&inst);
+        std::vector<StoreInst*> dependentStores;
+        if (loadInst && !getDependentStores(L, loadInst, allStores, otherWrites, dependentStores)) continue;
+
+        ret.insts.push_back(&inst);
+        ret.instSet.insert(&inst);
+        if (!dependentStores.empty()) ret.loadToStores[loadInst] = std::move(dependentStores);
+        if (ret.loadToStores.count(loadInst) || llvm::any_of(inst.operands(), [&](const Use& op) {
+          return ret.contains(op) && ret.mutableInsts.count(cast<Instruction>(op));
+        })) {
+          ret.mutableInsts.insert(&inst);
+        }
       }
-      else ++it;
-    } // can't use remove_if on std::map, and llvm::remove_if doesn't erase, and a map doesn't have range-based erase
-
-    // Remove any load/store pairs which are known to never alias
-    for (auto& [loadInst, dependentStores] : hoistLoadsToStores) {
-      auto end_it = llvm::remove_if(dependentStores, [&](auto* storeInst) {
-        return aliasResults.isNoAlias(MemoryLocation::get(loadInst), MemoryLocation::get(storeInst))
-            || (loadInst->getPointerOperand()->getType() != storeInst->getPointerOperand()->getType()); 
-            // TOCHECK: not great, assumes no alias of loads to different types, but makes thing easier
-      });
-      
-      dependentStores.erase(end_it, dependentStores.end());
-    } 
-
-    return hoistLoadsToStores;
-  }
-
-  void fixUpForStore(Loop *L, LoadInst* ogLoadInst, StoreInst* storeInst, AllocaInst* hoistedValue, CallBase* call, Value* ogPtrOp, LoopInfo* LI) {
-    auto* compForAlias = new ICmpInst(storeInst->getNextNode(), ICmpInst::ICMP_EQ, storeInst->getPointerOperand(), ogPtrOp);
-    auto* storeBB = storeInst->getParent();
-    auto* followingBB = storeBB->splitBasicBlock(compForAlias->getNextNode());
-    L->addBasicBlockToLoop(followingBB, *LI);
-    storeBB->getInstList().back().eraseFromParent(); // erase unconditional branch added by splitBasicBlock
-    
-    auto* f = storeBB->getParent();
-    auto* fixUpBB = BasicBlock::Create(f->getContext(), "", f);
-    L->addBasicBlockToLoop(fixUpBB, *LI);
-    auto* condCheckToFixUpBranch = BranchInst::Create(fixUpBB, followingBB, compForAlias, storeBB);
-    auto* fixUpEndBranch = BranchInst::Create(followingBB, fixUpBB);
+    }
+    return ret;
+  }
 
-    auto* loadParam = new LoadInst(ogPtrOp, "", fixUpBB->getTerminator());
-    auto* callVal = CallInst::Create(call->getFunctionType(), call->getCalledFunction(), {loadParam}, "", fixUpBB->getTerminator());
-    auto* fixUpStore = new StoreInst(callVal, hoistedValue, fixUpBB->getTerminator());
+  // loads of insts which storeInst may hit
+  std::vector<LoadInst*> getHitLoads(const InvariantTrees& trees, const std::vector<Instruction*>& insts, StoreInst* storeInst) {
+    std::vector<LoadInst*> ret;
+    for (auto* inst : insts) {
+      auto it = trees.loadToStores.find(dyn_cast<LoadInst>(inst));
+      if (it != trees.loadToStores.end() && llvm::is_contained(it->second, storeInst)) ret.push_back(it->first);
+    }
+    return ret;
   }
 
-  /* We only hoist loads and dependent pure function calls for this example
-    Not all loads have dependent pure function calls, so we handle the 2 cases a bit differently
-  */
-  void hoistLoadAndInsertFixUp(Loop *L, LoadInst* ogLoadInst, const std::vector<StoreInst*> dependentStores, std::unordered_map<LoadInst*, Value*>& loopLoadToHoisted, LoopInfo* LI) {
-    CallBase* call = nullptr;
-    for(auto* U : ogLoadInst->users()){  // find the dependent pure func call
-      if (auto* callBase = dyn_cast<CallBase>(U)){
-        if (isFunctionPure(callBase->getCalledFunction())) {
-          call = callBase;
-          break;
-        }
+  // what a fix-up redoes when hitLoads were hit: them and what depends on them, operands first
+  std::vector<Instruction*> getRecomputedInsts(const InvariantTrees& trees, const std::vector<LoadInst*>& hitLoads) {
+    std::vector<Instruction*> ret;
+    std::unordered_set<Value*> recomputed(hitLoads.begin(), hitLoads.end());
+    for (auto* inst : trees.insts) {
+      if (recomputed.count(inst) || llvm::any_of(inst->operands(), [&](const Use& op) { return recomputed.count(op); })) {
+        recomputed.insert(inst);
+        ret.push_back(inst);
+      }
+    }
+    return ret;
+  }
+
+  // stores which may hit some load of insts, in the order of the loads
+  std::vector<StoreInst*> getStoresToFixUp(const InvariantTrees& trees, const std::vector<Instruction*>& insts) {
+    std::vector<StoreInst*> ret;
+    for (auto* inst : insts) {
+      auto it = trees.loadToStores.find(dyn_cast<LoadInst>(inst));
+      if (it == trees.loadToStores.end()) continue;
+      for (auto* storeInst : it->second) {
+        if (!llvm::is_contained(ret, storeInst)) ret.push_back(storeInst);
       }
     }
-      
-    auto* function = ogLoadInst->getParent()->getParent();
-    auto& entryBB = function->getEntryBlock();
+    return ret;
+  }
 
-    /* Function Entry Block */
-    auto* hoistedType = call ? call->getType() : ogLoadInst->getType();
-    auto* hoistedValue = new AllocaInst(hoistedType, 0, nullptr, "", &(*entryBB.begin()));
+  bool isReadByLoop(const InvariantTrees& trees, Instruction* inst) {
+    return llvm::any_of(inst->users(), [&](User* U) { return !trees.contains(U); });
+  }
 
-    /* Loop Preheader */
-    Instruction* initVal;
-    LoadInst* initLoad;
-
-    /* this part is needed because the load for a pure func arg can be dependent on another loop invariant loads, which
-       would have already been hoisted -> ptrOperand used in pre-header has to be updated */
-    auto* loadPtrOp = ogLoadInst->getPointerOperand();
-    auto* ogPtrOp = loopLoadToHoisted.count(dyn_cast<LoadInst>(loadPtrOp)) ? loopLoadToHoisted[dyn_cast<LoadInst>(loadPtrOp)] : loadPtrOp;
-    
-    if (call) {
-      initLoad = new LoadInst(ogPtrOp, "", L->getLoopPreheader()->getTerminator());
-      auto* calledFunction = call->getCalledFunction();
-      initVal = CallInst::Create(calledFunction->getFunctionType(), calledFunction, {initLoad}, "", L->getLoopPreheader()->getTerminator());
+  // connected components of the insts, operands first
+  std::vector<std::vector<Instruction*>> getConnectedTrees(const InvariantTrees& trees) {
+    std::unordered_map<Instruction*, Instruction*> instToRoot;
+    std::function<Instruction*(Instruction*)> findRoot = [&](Instruction* inst) {
+      if (!instToRoot.count(inst) || instToRoot[inst] == inst) return inst;
+      return instToRoot[inst] = findRoot(instToRoot[inst]);
+    };
+    for (auto* inst : trees.insts) {
+      for (auto& op : inst->operands()) {
+        if (trees.contains(op)) instToRoot[findRoot(cast<Instruction>(op))] = findRoot(inst);
+      }
     }
-    else {
-      initVal = new LoadInst(ogPtrOp, "",  L->getLoopPreheader()->getTerminator());
+    std::map<Instruction*, size_t> rootToTree;
+    std::vector<std::vector<Instruction*>> ret;
+    for (auto* inst : trees.insts) {
+      auto [it, inserted] = rootToTree.insert({findRoot(inst), ret.size()});
+      if (inserted) ret.emplace_back();
+      ret[it->second].push_back(inst);
+    }
+    return ret;
+  }
+
+  // that storeInst hits one of hitLoads in an iteration of L, union bound
+  double getProbaHit(Loop* L, const std::vector<LoadInst*>& hitLoads, StoreInst* storeInst) {
+    auto& instLogAnalysis = getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis();
+    double ret = 0.0;
+    for (auto* loadInst : hitLoads) {
+      ret += getIterationAliasEstimate(instLogAnalysis, L, MemoryLocation::get(loadInst), MemoryLocation::get(storeInst)).probability;
     }
-    auto* storeInitVal = new StoreInst(initVal, hoistedValue, L->getLoopPreheader()->getTerminator());
+    return ret;
+  }
 
-    /* Loop header */
-    auto* headerLoadValue = new LoadInst(hoistedValue, "", ogLoadInst);
+  // that one of the stores of the tree of insts set its dirty flag since the loop last read it
+  double getProbaDirty(Loop* L, const InvariantTrees& trees, const std::vector<Instruction*>& insts) {
+    double ret = 0.0;
+    for (auto* storeInst : getStoresToFixUp(trees, insts)) ret += getProbaHit(L, getHitLoads(trees, insts, storeInst), storeInst);
+    return std::min(ret, 1.0);
+  }
 
-    for (auto* storeInst : dependentStores) {
-      fixUpForStore(L, ogLoadInst, storeInst, hoistedValue, call, ogPtrOp, LI);
+  /* Expected cycles saved per run of the function by hoisting the tree of insts: the preheader computes it once,
+     and every store which may hit one of its loads gets a check, plus a recompute of what it hit when it does */
+  double getHoistingSaving(Loop* L, const InvariantTrees& trees, const std::vector<Instruction*>& insts, const fp583::FunctionFrequencies& freqs) {
+    auto& f = *L->getHeader()->getParent();
+    double ret = 0.0;
+    for (auto* inst : insts) {
+      double instCost = costModel.getInstCost(inst);
+      ret += (freqs.getFrequency(inst->getParent()) - freqs.getFrequency(L->getLoopPreheader())) * instCost;
     }
 
-    if (call) {
-      call->replaceAllUsesWith(headerLoadValue);
-      call->eraseFromParent();
+    auto getRecomputeCost = [&](const std::vector<Instruction*>& recomputedInsts) {
+      double ret = 0.0;
+      for (auto* inst : recomputedInsts) ret += costModel.getInstCost(inst);
+      return ret;
+    };
+    auto* boolType = Type::getInt1Ty(f.getContext());
+    double flagCost = costModel.getMemoryOpCost(f, Instruction::Load, boolType) + costModel.getMemoryOpCost(f, Instruction::Store, boolType);
+    double probaDirty = 0.0;
+
+    for (auto* storeInst : getStoresToFixUp(trees, insts)) {
+      auto hitLoads = getHitLoads(trees, insts, storeInst);
+      double probaHit = getProbaHit(L, hitLoads, storeInst);
+      double checkCost = costModel.getCheckCost(f, std::vector<Type*>(hitLoads.size(), storeInst->getPointerOperandType()));
+      if (LICMFixUps == FixUpStrategy::Lazy) { // the or in the flag instead of the branch
+        ret -= freqs.getFrequency(storeInst->getParent()) * (checkCost + flagCost);
+        probaDirty += probaHit;
+      }
+      else {
+        double recomputeCost = getRecomputeCost(getRecomputedInsts(trees, hitLoads));
+        ret -= freqs.getFrequency(storeInst->getParent()) * (checkCost + std::min(probaHit, 1.0) * (costModel.mispredictCost + recomputeCost));
+      }
+    }
+
+    // lazy fix-ups: every read of the tree by the loop checks the flag, and redoes the whole tree when it's set
+    if (probaDirty > 0.0) {
+      std::vector<Instruction*> mutableInsts;
+      llvm::copy_if(insts, std::back_inserter(mutableInsts), [&](Instruction* inst) { return trees.mutableInsts.count(inst); });
+      double recomputeCost = getRecomputeCost(mutableInsts);
+      for (auto* inst : mutableInsts) {
+        if (!isReadByLoop(trees, inst)) continue;
+        double checkCost = costModel.getMemoryOpCost(f, Instruction::Load, boolType) + costModel.getCheckCost(f, {});
+        ret -= freqs.getFrequency(inst->getParent()) * (checkCost + std::min(probaDirty, 1.0) * (costModel.mispredictCost + recomputeCost));
+      }
+    }
+    return ret;
+  }
+
+  /* Drop the trees whose hoisting doesn't pay for its checks. A tree is a connected component of the insts, e.g.
+     the load of a pointer goes with the loads through it, which can't be hoisted without it */
+  void removeUnprofitableTrees(Loop* L, InvariantTrees& trees) {
+    fp583::FunctionFrequencies freqs(*L->getHeader()->getParent());
+    std::unordered_set<Instruction*> unprofitableInsts;
+    for (auto& insts : getConnectedTrees(trees)) {
+      if (getHoistingSaving(L, trees, insts, freqs) <= 0.0) unprofitableInsts.insert(insts.begin(), insts.end());
+    }
+    llvm::erase_if(trees.insts, [&](Instruction* inst) { return unprofitableInsts.count(inst); });
+    for (auto* inst : unprofitableInsts) {
+      trees.instSet.erase(inst);
+      trees.mutableInsts.erase(inst);
+      if (auto* loadInst = dyn_cast<LoadInst>(inst)) trees.loadToStores.erase(loadInst);
+    }
+  }
+
+  /* What stands for the current value of val once hoisted: its preheader value, or val itself when a store may
+     have changed it since, whose uses get the value of the preheader or of the last fix-up at the end */
+  Value* getCurrentValue(InvariantTrees& trees, Value* val) {
+    if (!trees.contains(val)) return val;
+    auto* inst = cast<Instruction>(val);
+    return trees.mutableInsts.count(inst) ? inst : trees.instToPreheaderVal[inst];
+  }
+
+  // whether storeInst hit one of hitLoads, computed before insertBefore
+  Value* generateHitCheck(InvariantTrees& trees, StoreInst* storeInst, const std::vector<LoadInst*>& hitLoads, Instruction* insertBefore) {
+    IRBuilder<> builder(insertBefore);
+    Value* compForAlias = nullptr;
+    for (auto* loadInst : hitLoads) {
+      auto* comp = generateOverlapICmp(builder, loadInst, getCurrentValue(trees, loadInst->getPointerOperand()), storeInst);
+      compForAlias = compForAlias ? builder.CreateOr(compForAlias, comp) : comp;
+    }
+    return compForAlias;
+  }
+
+  /*   currBB:      ...  br cond, fixUpBB, followingBB, !prof (cond with probability probaFixUp)
+       fixUpBB:     br followingBB
+       followingBB: insertBefore ...
+     returns fixUpBB */
+  BasicBlock* insertFixUpBlock(Value* cond, double probaFixUp, Instruction* insertBefore, LoopInfo* LI) {
+    auto* currBB = insertBefore->getParent();
+    auto* currLoop = LI->getLoopFor(currBB); // L or one of its subloops
+    auto* followingBB = currBB->splitBasicBlock(insertBefore);
+    currLoop->addBasicBlockToLoop(followingBB, *LI);
+    currBB->getInstList().back().eraseFromParent(); // erase unconditional branch added by splitBasicBlock
+
+    auto* f = currBB->getParent();
+    auto* fixUpBB = BasicBlock::Create(f->getContext(), "", f);
+    currLoop->addBasicBlockToLoop(fixUpBB, *LI);
+    auto* condCheckToFixUpBranch = BranchInst::Create(fixUpBB, followingBB, cond, currBB);
+    condCheckToFixUpBranch->setMetadata(LLVMContext::MD_prof, createFixUpWeights(f->getContext(), probaFixUp));
+    BranchInst::Create(followingBB, fixUpBB);
+    return fixUpBB;
+  }
+
+  // redo insts (operands first) in a fix-up before insertBefore, the other values are taken as they are
+  void recomputeInsts(InvariantTrees& trees, const std::vector<Instruction*>& insts, Instruction* insertBefore) {
+    std::unordered_map<Value*, Value*> instToRecomputed;
+    for (auto* inst : insts) {
+      auto* recomputed = inst->clone();
+      recomputed->insertBefore(insertBefore);
+      markColdInFixUp(recomputed);
+      for (auto& op : recomputed->operands()) {
+        op.set(instToRecomputed.count(op) ? instToRecomputed[op] : getCurrentValue(trees, op));
+      }
+      instToRecomputed[inst] = recomputed;
+      trees.instToRecomputed[inst].push_back(recomputed);
+    }
+  }
+
+  void countMisspeculation(InvariantTrees& trees, BasicBlock* fixUpBB) {
+    if (!trees.misspeculations) return;
+    IRBuilder<> builder(fixUpBB->getTerminator());
+    auto* countType = trees.misspeculations->getValueType();
+    builder.CreateStore(builder.CreateAdd(builder.CreateLoad(countType, trees.misspeculations), ConstantInt::get(countType, 1)), trees.misspeculations);
+  }
+
+  // only what the store may have invalidated is redone
+  void fixUpForStore(Loop* L, StoreInst* storeInst, InvariantTrees& trees, LoopInfo* LI) {
+    auto hitLoads = getHitLoads(trees, trees.insts, storeInst);
+    auto* insertBefore = storeInst->getNextNode();
+    auto* hit = generateHitCheck(trees, storeInst, hitLoads, insertBefore);
+    auto* fixUpBB = insertFixUpBlock(hit, std::min(getProbaHit(L, hitLoads, storeInst), 1.0), insertBefore, LI);
+    std::vector<std::pair<Instruction*, Instruction*>> speculatedPairs;
+    for (auto* loadInst : hitLoads) speculatedPairs.push_back({loadInst, storeInst});
+    countFixUps(getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis(), "fp_licmoptim", fixUpBB, speculatedPairs);
+    countMisspeculation(trees, fixUpBB);
+    recomputeInsts(trees, getRecomputedInsts(trees, hitLoads), fixUpBB->getTerminator());
+  }
+
+  /* The stores which may hit a load of tree only set its dirty flag, no branch. Where the loop reads a value of
+     the tree back, a set flag redoes all its mutable insts first: the pointers the stores compare to may be stale
+     once it is set, so which loads were hit isn't known anymore */
+  void insertLazyFixUps(Loop* L, InvariantTrees& trees, const std::vector<Instruction*>& tree, LoopInfo* LI) {
+    auto stores = getStoresToFixUp(trees, tree);
+    if (stores.empty()) return;
+    auto& ctx = L->getHeader()->getContext();
+    auto& entryBB = L->getHeader()->getParent()->getEntryBlock();
+    auto* boolType = Type::getInt1Ty(ctx);
+    auto* dirtyFlag = new AllocaInst(boolType, 0, nullptr, "", &(*entryBB.begin()));
+    new StoreInst(ConstantInt::getFalse(ctx), dirtyFlag, L->getLoopPreheader()->getTerminator());
+
+    for (auto* storeInst : stores) {
+      auto* insertBefore = storeInst->getNextNode();
+      auto* hit = generateHitCheck(trees, storeInst, getHitLoads(trees, tree, storeInst), insertBefore);
+      auto* wasDirty = new LoadInst(boolType, dirtyFlag, "", insertBefore);
+      new StoreInst(BinaryOperator::CreateOr(wasDirty, hit, "", insertBefore), dirtyFlag, insertBefore);
+    }
+
+    std::vector<Instruction*> mutableInsts;
+    llvm::copy_if(tree, std::back_inserter(mutableInsts), [&](Instruction* inst) { return trees.mutableInsts.count(inst); });
+    double probaDirty = getProbaDirty(L, trees, tree);
+    std::vector<std::pair<Instruction*, Instruction*>> speculatedPairs; // all the ones of the tree, which may have set the flag
+    for (auto* storeInst : stores) {
+      for (auto* loadInst : getHitLoads(trees, tree, storeInst)) speculatedPairs.push_back({loadInst, storeInst});
+    }
+    for (auto* inst : mutableInsts) {
+      if (!isReadByLoop(trees, inst)) continue;
+      auto* isDirty = new LoadInst(boolType, dirtyFlag, "", inst);
+      auto* fixUpBB = insertFixUpBlock(isDirty, probaDirty, inst, LI);
+      countFixUps(getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis(), "fp_licmoptim", fixUpBB, speculatedPairs);
+      countMisspeculation(trees, fixUpBB);
+      recomputeInsts(trees, mutableInsts, fixUpBB->getTerminator());
+      new StoreInst(ConstantInt::getFalse(ctx), dirtyFlag, fixUpBB->getTerminator());
+    }
+  }
+
+  void hoistTreesAndInsertFixUps(Loop* L, InvariantTrees& trees, LoopInfo* LI) {
+    auto* preheaderEnd = L->getLoopPreheader()->getTerminator();
+    // the loop reads a mutable inst as it was where the inst was, the fix-ups as it is where they are
+    std::unordered_map<Instruction*, SmallVector<Use*, 8>> instToLoopUses;
+    for (auto* inst : trees.mutableInsts) {
+      for (auto& U : inst->uses()) {
+        if (!trees.contains(U.getUser())) instToLoopUses[inst].push_back(&U);
+      }
+    }
+
+    /* Loop Preheader */
+    for (auto* inst : trees.insts) {
+      auto* initVal = inst->clone();
+      initVal->insertBefore(preheaderEnd);
+      for (auto& op : initVal->operands()) {
+        if (trees.contains(op)) op.set(trees.instToPreheaderVal[cast<Instruction>(op)]);
+      }
+      trees.instToPreheaderVal[inst] = initVal;
+    }
+
+    if (LICMFixUps == FixUpStrategy::Lazy) {
+      for (auto& tree : getConnectedTrees(trees)) insertLazyFixUps(L, trees, tree, LI);
     }
     else {
-      ogLoadInst->replaceAllUsesWith(headerLoadValue);
-      loopLoadToHoisted[headerLoadValue] = initVal;
+      for (auto* storeInst : getStoresToFixUp(trees, trees.insts)) fixUpForStore(L, storeInst, trees, LI);
     }
-    ogLoadInst->eraseFromParent();
+
+    /* Loop body: the uses of the mutable insts get phis of their preheader and fix-up values, once the CFG won't
+       change anymore. The others were invariant after all */
+    for (auto* inst : trees.insts) {
+      if (!trees.mutableInsts.count(inst)) {
+        inst->replaceUsesWithIf(trees.instToPreheaderVal[inst], [&](Use& U) { return !trees.contains(U.getUser()); });
+        continue;
+      }
+      SSAUpdater updater;
+      updater.Initialize(inst->getType(), inst->getName());
+      updater.AddAvailableValue(L->getLoopPreheader(), trees.instToPreheaderVal[inst]);
+      for (auto* recomputed : trees.instToRecomputed[inst]) {
+        updater.AddAvailableValue(recomputed->getParent(), recomputed);
+      }
+      auto* valAtInst = updater.GetValueInMiddleOfBlock(inst->getParent()); // no fix-up ends in the block of inst
+      for (auto* U : instToLoopUses[inst]) U->set(valAtInst);
+      SmallVector<Use*, 8> fixUpUses;
+      for (auto& U : inst->uses()) {
+        if (!trees.contains(U.getUser())) fixUpUses.push_back(&U);
+      }
+      for (auto* U : fixUpUses) updater.RewriteUse(*U);
+    }
+    for (auto it = trees.insts.rbegin(); it != trees.insts.rend(); ++it) {
+      (*it)->eraseFromParent();
+    }
+  }
+
+  // only hoist what no store of the loop may change
+  void removeMutableInsts(InvariantTrees& trees) {
+    llvm::erase_if(trees.insts, [&](Instruction* inst) { return trees.mutableInsts.count(inst); });
+    for (auto* inst : trees.mutableInsts) trees.instSet.erase(inst);
+    trees.mutableInsts.clear();
+    trees.loadToStores.clear();
+  }
+
+  /* Bound what a speculation which stopped paying off costs: L gets an untouched copy, run instead of it from the
+     first entry after its fix-ups ran DespeculateAfter times. Loops which can't be versioned don't speculate */
+  void keepDespeculatedCopy(Loop* L, InvariantTrees& trees, LoopInfo* LI) {
+    DominatorTree DT(*L->getHeader()->getParent());
+    if (!L->isLoopSimplifyForm() || !L->isLCSSAForm(DT) || !L->getExitBlock()) {
+      removeMutableInsts(trees);
+      return;
+    }
+    auto& m = *L->getHeader()->getModule();
+    auto* countType = Type::getInt64Ty(m.getContext());
+    trees.misspeculations = new GlobalVariable(m, countType, false, GlobalValue::PrivateLinkage, ConstantInt::get(countType, 0), "fp583.misspeculations");
+
+    auto* checkBB = L->getLoopPreheader();
+    IRBuilder<> builder(checkBB->getTerminator());
+    auto* despeculated = builder.CreateICmpUGE(builder.CreateLoad(countType, trees.misspeculations), ConstantInt::get(countType, DespeculateAfter));
+    versionLoop(L, despeculated, *LI, DT);
+    checkBB->getTerminator()->setMetadata(LLVMContext::MD_prof, createFixUpWeights(m.getContext(), 0.0));
   }
 
   bool runOnLoop(Loop *L, LPPassManager &LPM) override {
     // if (L->getBlocks().front()->getParent()->getName() != "main") return false;
-    auto mostlyInvariantLoads = getMostlyInvariantLoads(L);
-    std::unordered_map<LoadInst*, Value*> loopLoadToHoisted;
+    if (!L->getLoopPreheader()) return false;
+    costModel.getTTI = [this](Function& f) -> const TargetTransformInfo& {
+      return getAnalysis<TargetTransformInfoWrapperPass>().getTTI(f);
+    };
+    costModel.mispredictCost = MispredictCost;
     auto* LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
 
-    for (auto& [loadInst, dependentStores] : mostlyInvariantLoads) {
-      hoistLoadAndInsertFixUp(L, loadInst, dependentStores, loopLoadToHoisted, LI);
+    auto trees = getInvariantTrees(L, LI);
+    if (UseCostModel) {
+      removeUnprofitableTrees(L, trees);
     }
+    if (DespeculateAfter > 0 && !trees.mutableInsts.empty()) {
+      keepDespeculatedCopy(L, trees, LI);
+    }
+    if (trees.insts.empty()) return false;
 
-    return !mostlyInvariantLoads.empty();
+    hoistTreesAndInsertFixUps(L, trees, LI);
+    return true;
   }
 }; // end of struct LICMAliasProfilePass
+
+
+/* ****************************************************************** */
+
+// LOOP VERSIONING PASS
+
+/* ****************************************************************** */
+
+
+/*
+  Version innermost loops in which the profile says the loads and stores practically never alias:
+    check:  if (the address ranges of 2 of these accesses overlap) goto slow.ph; else goto fast.ph
+    fast:   the original loop, its loads through loop invariant pointers hoisted to its preheader, its accesses
+            marked noalias and the loop marked for vectorization
+    slow:   an untouched copy of the loop
+  Unlike LICMAliasProfilePass, the fast loop has no fix-up after its stores, the check before the loop covers all
+  of its iterations. The address ranges come from SCEV (loop invariant or affine pointers, trip count known on entry),
+  other loops are left alone. Ranges can overlap while the pointers never collide, such invocations run the slow loop.
+*/
+struct LoopVersioningAliasProfilePass : public LoopPass {
+  static char ID;
+  double aliasProbaThreshold = LoopVersioningAliasThreshold;
+  size_t maxNumChecks = 8; // 2 compares each, all run on every entry of the loop
+
+  using AccessRange = std::pair<const SCEV*, const SCEV*>; // [low, high) addresses accessed over the whole loop
+
+  LoopVersioningAliasProfilePass() : LoopPass(ID) {}
+
+  void getAnalysisUsage(AnalysisUsage& AU) const override {
+    // not requiring LoopSimplify and LCSSA as they would invalidate InstLogAnalysisWrapperPass, see runOnLoop
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<AAResultsWrapperPass>();
+    AU.addRequired<fp583::InstLogAnalysisWrapperPass>();
+    AU.addPreserved<DominatorTreeWrapperPass>();
+    AU.addPreserved<LoopInfoWrapperPass>();
+    AU.addPreserved<ScalarEvolutionWrapperPass>();
+  }
+
+  bool isTooLikelyToAlias(const fp583::InstLogAnalysis& instLogAnalysis, Loop* L, const MemoryLocation& loc_a, const MemoryLocation& loc_b) {
+    auto aliasEstimate = getIterationAliasEstimate(instLogAnalysis, L, loc_a, loc_b);
+    return !aliasEstimate.known || aliasEstimate.upper > aliasProbaThreshold;
+  }
+
+  /* false if SCEV can't tell the addresses before the loop runs */
+  bool getAccessRange(Loop* L, ScalarEvolution& SE, Instruction* inst, AccessRange& range) {
+    auto* ptr = getLoadStorePointerOperand(inst);
+    if (ptr->getType()->getPointerAddressSpace() != 0) return false;
+    auto& DL = inst->getModule()->getDataLayout();
+    auto* accessSize = SE.getConstant(DL.getIntPtrType(ptr->getType()), DL.getTypeStoreSize(getLoadStoreType(inst)).getFixedSize());
+
+    auto* ptrSCEV = SE.getSCEV(ptr);
+    const SCEV *first = ptrSCEV, *last = ptrSCEV;
+    if (!SE.isLoopInvariant(ptrSCEV, L)) {
+      auto* addRec = dyn_cast<SCEVAddRecExpr>(ptrSCEV);
+      auto* backedgeTakenCount = SE.getBackedgeTakenCount(L);
+      if (!addRec || addRec->getLoop() != L || !addRec->isAffine() || isa<SCEVCouldNotCompute>(backedgeTakenCount)) return false;
+      auto* step = dyn_cast<SCEVConstant>(addRec->getStepRecurrence(SE));
+      auto* gep = dyn_cast<GetElementPtrInst>(ptr);
+      // a pointer wrapping around the address space would access more than [first, last]
+      if (!step || !(addRec->getNoWrapFlags(SCEV::FlagNW) || (gep && gep->isInBounds()))) return false;
+
+      first = addRec->getStart();
+      last = addRec->evaluateAtIteration(backedgeTakenCount, SE);
+      if (step->getAPInt().isNegative()) std::swap(first, last);
+    }
+    range = {first, SE.getAddExpr(last, accessSize)};
+
+    auto* checkPt = L->getLoopPreheader()->getTerminator();
+    return isSafeToExpandAt(range.first, checkPt, SE) && isSafeToExpandAt(range.second, checkPt, SE);
+  }
+
+  /* or of (low_a < high_b && low_b < high_a) over the pairs, inserted before checkPt */
+  Value* generateOverlapCheck(ScalarEvolution& SE, Instruction* checkPt, const std::vector<std::pair<Instruction*, StoreInst*>>& checkedPairs,
+                              std::unordered_map<Instruction*, AccessRange>& accessRanges) {
+    SCEVExpander expander(SE, checkPt->getModule()->getDataLayout(), "fp.versioning");
+    auto* bytePtrType = Type::getInt8PtrTy(checkPt->getContext());
+    IRBuilder<> builder(checkPt);
+    Value* anyOverlap = nullptr;
+    for (auto& [inst, storeInst] : checkedPairs) {
+      auto* low_a = expander.expandCodeFor(accessRanges[inst].first, bytePtrType, checkPt);
+      auto* high_a = expander.expandCodeFor(accessRanges[inst].second, bytePtrType, checkPt);
+      auto* low_b = expander.expandCodeFor(accessRanges[storeInst].first, bytePtrType, checkPt);
+      auto* high_b = expander.expandCodeFor(accessRanges[storeInst].second, bytePtrType, checkPt);
+      auto* aBeforeEndOfB = builder.CreateICmpULT(low_a, high_b);
+      auto* bBeforeEndOfA = builder.CreateICmpULT(low_b, high_a);
+      auto* overlap = builder.CreateAnd(aBeforeEndOfB, bBeforeEndOfA, "fp.overlap");
+      anyOverlap = anyOverlap ? builder.CreateOr(anyOverlap, overlap, "fp.overlap") : overlap;
+    }
+    return anyOverlap;
+  }
+
+  /* Tell the rest of the pipeline what the check proved: every checked access gets its own scope, and is noalias
+     with the scopes of the accesses it was checked against. Then LoopVectorize and SLP don't need checks of their own */
+  void annotateFastLoop(Loop* L, const std::vector<std::pair<Instruction*, StoreInst*>>& checkedPairs) {
+    auto& ctx = L->getHeader()->getContext();
+    MDBuilder mdBuilder(ctx);
+    auto* domain = mdBuilder.createAnonymousAliasScopeDomain("fp583.versioning");
+    std::unordered_map<Instruction*, MDNode*> accessToScope;
+    std::unordered_map<Instruction*, SmallVector<Metadata*, 4>> accessToNoAliasScopes;
+    for (auto& [inst, storeInst] : checkedPairs) {
+      for (Instruction* access : {inst, (Instruction*)storeInst}) {
+        if (!accessToScope.count(access)) accessToScope[access] = mdBuilder.createAnonymousAliasScope(domain);
+      }
+      accessToNoAliasScopes[inst].push_back(accessToScope[storeInst]);
+      accessToNoAliasScopes[storeInst].push_back(accessToScope[inst]);
+    }
+    for (auto& [access, scope] : accessToScope) {
+      access->setMetadata(LLVMContext::MD_alias_scope,
+                          MDNode::concatenate(access->getMetadata(LLVMContext::MD_alias_scope), MDNode::get(ctx, scope)));
+      access->setMetadata(LLVMContext::MD_noalias,
+                          MDNode::concatenate(access->getMetadata(LLVMContext::MD_noalias), MDNode::get(ctx, accessToNoAliasScopes[access])));
+    }
+    addStringMetadataToLoop(L, "llvm.loop.vectorize.enable", 1);
+  }
+
+  /* Loops have to be in simplified and LCSSA form already (opt -mem2reg -loop-simplify -lcssa before profiling) */
+  bool runOnLoop(Loop *L, LPPassManager &) override {
+    auto& instLogAnalysis = getAnalysis<fp583::InstLogAnalysisWrapperPass>().getInstLogAnalysis();
+    auto& aliasResults = getAnalysis<AAResultsWrapperPass>().getAAResults();
+    auto& SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+    auto& LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    auto& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    if (!L->isInnermost() || !L->isLoopSimplifyForm() || !L->isLCSSAForm(DT) || !L->getExitBlock()
+        || findStringMetadataForLoop(L, "fp583.loop.versioned")) {
+      return false;
+    }
+
+    std::vector<LoadInst*> loads;
+    std::vector<StoreInst*> stores;
+    for (auto* bb : L->getBlocks()) {
+      for (auto& inst : *bb) {
+        if (auto* loadInst = dyn_cast<LoadInst>(&inst)) {
+          if (!loadInst->isSimple()) return false;
+          loads.push_back(loadInst);
+        }
+        else if (auto* storeInst = dyn_cast<StoreInst>(&inst)) {
+          if (!storeInst->isSimple()) return false;
+          stores.push_back(storeInst);
+        }
+        else if (auto* call = dyn_cast<CallBase>(&inst); call && call->doesNotAccessMemory()) {
+          continue;
+        }
+        else if (inst.mayReadOrWriteMemory()) return false; // any other call could write anywhere, _PURE_ ones too
+      }
+    }
+
+    // pairs the check has to rule out, and accesses aliasing others where the check doesn't help
+    std::vector<std::pair<Instruction*, StoreInst*>> checkedPairs;
+    std::unordered_set<Instruction*> uncheckedAccesses;
+    auto addPair = [&](Instruction* inst, StoreInst* storeInst) {
+      auto loc_a = MemoryLocation::get(inst), loc_b = MemoryLocation::get(storeInst);
+      auto aliasResult = aliasResults.alias(loc_a, loc_b);
+      if (aliasResult == AliasResult::MayAlias) {
+        if (isTooLikelyToAlias(instLogAnalysis, L, loc_a, loc_b)) return false;
+        checkedPairs.push_back({inst, storeInst});
+      }
+      else if (aliasResult != AliasResult::NoAlias) {
+        uncheckedAccesses.insert(inst);
+        uncheckedAccesses.insert(storeInst);
+      }
+      return true;
+    };
+    for (size_t i = 0; i < stores.size(); ++i) {
+      for (auto* loadInst : loads)
+        if (!addPair(loadInst, stores[i])) return false;
+      for (size_t j = 0; j < i; ++j)
+        if (!addPair(stores[j], stores[i])) return false;
+    }
+    if (checkedPairs.empty() || checkedPairs.size() > maxNumChecks) return false;
+
+    std::unordered_map<Instruction*, AccessRange> accessRanges;
+    for (auto& [inst, storeInst] : checkedPairs) {
+      for (Instruction* access : {inst, (Instruction*)storeInst}) {
+        if (accessRanges.count(access)) continue;
+        if (!getAccessRange(L, SE, access, accessRanges[access])) return false;
+      }
+    }
+
+    // in the fast loop no store writes where these read, they have to run in every invocation to be read up front
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    L->getExitingBlocks(exitingBlocks);
+    std::vector<LoadInst*> hoistedLoads;
+    for (auto* loadInst : loads) {
+      if (uncheckedAccesses.count(loadInst) || !L->isLoopInvariant(loadInst->getPointerOperand())) continue;
+      if (llvm::all_of(exitingBlocks, [&](auto* exitingBB) { return DT.dominates(loadInst->getParent(), exitingBB); })) {
+        hoistedLoads.push_back(loadInst);
+      }
+    }
+
+    addStringMetadataToLoop(L, "fp583.loop.versioned"); // copied to the slow loop, neither gets versioned again
+    auto* conflict = generateOverlapCheck(SE, L->getLoopPreheader()->getTerminator(), checkedPairs, accessRanges);
+    versionLoop(L, conflict, LI, DT);
+    annotateFastLoop(L, checkedPairs);
+    for (auto* loadInst : hoistedLoads) {
+      loadInst->moveBefore(L->getLoopPreheader()->getTerminator());
+    }
+    SE.forgetLoop(L);
+    return true;
+  }
+}; // end of struct LoopVersioningAliasProfilePass
 }  // end of anonymous namespace
 
 char FuncCallsAliasProfilePass::ID = 0;
 char LICMAliasProfilePass::ID = 1;
+char LoopVersioningAliasProfilePass::ID = 2;
+char RedundantLoadsAliasProfilePass::ID = 3;
 static RegisterPass<FuncCallsAliasProfilePass> x("fp_funcoptim", "FuncCallsAliasProfilePass Pass",
                              false /* Only looks at CFG */,
                              false /* Analysis Pass */);
 static RegisterPass<LICMAliasProfilePass> xx("fp_licmoptim", "LICMAliasProfilePass Pass",
                              false /* Only looks at CFG */,
                              false /* Analysis Pass */);
+static RegisterPass<LoopVersioningAliasProfilePass> xxx("fp_loopversion", "LoopVersioningAliasProfilePass Pass",
+                             false /* Only looks at CFG */,
+                             false /* Analysis Pass */);
+static RegisterPass<RedundantLoadsAliasProfilePass> xxxx("fp_loadoptim", "RedundantLoadsAliasProfilePass Pass",
+                             false /* Only looks at CFG */,
+                             false /* Analysis Pass */);
@@ -0,0 +1,99 @@
+#ifndef _SPECULATION_COST_H_
+#define _SPECULATION_COST_H_
+
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+using namespace llvm;
+
+namespace fp583 {
+
+/* Frequencies of the blocks of a function per run of its entry, from its branch weights or the static heuristics
+   of BranchProbabilityInfo. Built on demand rather than required, the passes need them for callees and after
+   changing the CFG */
+struct FunctionFrequencies {
+  DominatorTree DT;
+  LoopInfo LI;
+  BranchProbabilityInfo BPI;
+  BlockFrequencyInfo BFI;
+
+  explicit FunctionFrequencies(Function& f) : DT(f), LI(DT), BPI(f, LI, nullptr, &DT), BFI(f, BPI, LI) {}
+
+  double getFrequency(const BasicBlock* bb) const {
+    return (double)BFI.getBlockFreq(bb).getFrequency() / BFI.getEntryFreq();
+  }
+};
+
+/*
+Expected cycles saved by a speculation, per run of the function's entry:
+  sum of freq(block) * cost(work) over the work removed
+  - sum of freq(block) * (cost(check) + P(misspeculation) * (mispredictCost + cost(fix-up))) over the checks added
+Costs are TTI latencies. A call costs its callee's body weighted by the callee's own block frequencies, or
+declarationCost when there's no body to look at (libm).
+*/
+struct SpeculationCostModel {
+  std::function<const TargetTransformInfo&(Function&)> getTTI;
+  double mispredictCost = 15.0;
+  double declarationCost = 20.0;
+  std::unordered_map<const Function*, double> functionToCost;
+
+  static double toCycles(InstructionCost cost) {
+    return cost.isValid() ? (double)*cost.getValue() : 1.0;
+  }
+
+  double getInstCost(const Instruction* inst) {
+    double ret = toCycles(getTTI(*const_cast<Function*>(inst->getFunction())).getInstructionCost(inst, TargetTransformInfo::TCK_Latency));
+    if (auto* call = dyn_cast<CallBase>(inst); call && !isa<IntrinsicInst>(call)) {
+      ret += getFunctionCost(call->getCalledFunction());
+    }
+    return ret;
+  }
+
+  // of a call to f, not counting the call itself
+  double getFunctionCost(Function* f) {
+    if (!f || f->isDeclaration()) return declarationCost;
+    if (auto it = functionToCost.find(f); it != functionToCost.end()) return it->second;
+    functionToCost[f] = declarationCost; // recursive calls while f is looked at
+    FunctionFrequencies freqs(*f);
+    double ret = 0.0;
+    for (auto& bb : *f) {
+      double bbCost = 0.0;
+      for (auto& inst : bb) bbCost += getInstCost(&inst);
+      ret += freqs.getFrequency(&bb) * bbCost;
+    }
+    functionToCost[f] = ret;
+    return ret;
+  }
+
+  // of a load or store of a value of type
+  double getMemoryOpCost(Function& f, unsigned opcode, Type* type) {
+    return toCycles(getTTI(f).getMemoryOpCost(opcode, type, Align(), 0, TargetTransformInfo::TCK_Latency));
+  }
+
+  // a compare of every pair of values (numbers bit for bit), or'ed together, and the branch to the fix-up
+  double getCheckCost(Function& f, const std::vector<Type*>& comparedTypes) {
+    auto& TTI = getTTI(f);
+    auto& DL = f.getParent()->getDataLayout();
+    auto* boolType = Type::getInt1Ty(f.getContext());
+    double ret = toCycles(TTI.getCFInstrCost(Instruction::Br, TargetTransformInfo::TCK_Latency));
+    for (size_t i = 0; i < comparedTypes.size(); ++i) {
+      auto* type = comparedTypes[i];
+      if (type->isFloatingPointTy()) type = IntegerType::get(f.getContext(), DL.getTypeSizeInBits(type));
+      ret += toCycles(TTI.getCmpSelInstrCost(Instruction::ICmp, type, boolType, CmpInst::BAD_ICMP_PREDICATE, TargetTransformInfo::TCK_Latency));
+      if (i > 0) ret += toCycles(TTI.getArithmeticInstrCost(Instruction::Or, boolType, TargetTransformInfo::TCK_Latency));
+    }
+    return ret;
+  }
+};
+} // end of namespace fp583
+
+#endif /* _SPECULATION_COST_H_ */
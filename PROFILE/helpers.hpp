@@ -2,9 +2,15 @@
 #define _HELPERS_H_
 
 #include "llvm/IR/Function.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Support/raw_ostream.h"
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include "../fp_trace.h"
 
 using namespace llvm;
 
@@ -36,4 +42,75 @@ std::unordered_map<MemoryLocation, size_t> getMemLocToId(Module& m) {
   return ret;
 }
 
+// Functions defined by fp.h, they get ids like everything else but must never be instrumented
+bool isInstLogRuntimeFunction(const Function& f) {
+  auto name = f.getName();
+  return name.startswith("_inst_log") || name == "_loop_enter_log" || name == "_loop_iter_log" || name == "_frame_exit_log"
+      || name.startswith("_fixup_counts");
+}
+
+// Function whose stack frame holds the location, nullptr if the location outlives calls (globals, heap, ...)
+const Function* getStackFrameFunction(const Value* ptr) {
+  auto* alloca = dyn_cast<AllocaInst>(getUnderlyingObject(ptr));
+  return alloca ? alloca->getFunction() : nullptr;
+}
+
+// Functions holding profiled stack locations get ids in module order, starting at 1 (0 is "not on the stack")
+std::unordered_map<const Function*, size_t> getFrameIds(Module& m, const std::unordered_map<MemoryLocation, size_t>& memLocToId) {
+  std::unordered_set<const Function*> frameFuncs;
+  for (auto& [memLoc, Id] : memLocToId) {
+    if (auto* frameFunc = getStackFrameFunction(memLoc.Ptr)) frameFuncs.insert(frameFunc);
+  }
+  std::unordered_map<const Function*, size_t> ret;
+  size_t id = 1;
+  for (auto& func : m) {
+    if (frameFuncs.count(&func) && !isInstLogRuntimeFunction(func)) ret[&func] = id++;
+  }
+  return ret;
+}
+
+struct LoopIds {
+  std::unordered_map<const BasicBlock*, size_t> headerToId;
+  std::unordered_map<const BasicBlock*, size_t> blockToId; // innermost loop containing the block
+  std::vector<size_t> parentId; // indexed by loop id, 0 means top level
+
+  LoopIds() : parentId(1, 0) {}
+
+  size_t getLoopId(const Value* val) const {
+    if (auto* inst = dyn_cast<Instruction>(val)) {
+      auto it = blockToId.find(inst->getParent());
+      if (it != blockToId.end()) return it->second;
+    }
+    return 0;
+  }
+
+  // true if loop outerId strictly contains loop innerId, id 0 contains every loop
+  bool encloses(size_t outerId, size_t innerId) const {
+    while (innerId != 0) {
+      innerId = parentId[innerId];
+      if (innerId == outerId) return true;
+    }
+    return false;
+  }
+};
+
+// Ids are assigned to loops in function order then loop preorder, starting at 1 (0 is "not in a loop").
+// Only depends on the CFG, so the ids are the same before and after the profile pass instruments the module
+LoopIds getLoopIds(Module& m, const std::function<LoopInfo&(Function&)>& getLoopInfo) {
+  LoopIds ret;
+  for (auto& func : m) {
+    if (func.isDeclaration()) continue;
+    auto& loopInfo = getLoopInfo(func);
+    for (auto* loop : loopInfo.getLoopsInPreorder()) {
+      size_t id = ret.parentId.size();
+      ret.headerToId[loop->getHeader()] = id;
+      ret.parentId.push_back(loop->getParentLoop() ? ret.headerToId.at(loop->getParentLoop()->getHeader()) : 0);
+    }
+    for (auto& bb : func) {
+      if (auto* loop = loopInfo.getLoopFor(&bb)) ret.blockToId[&bb] = ret.headerToId.at(loop->getHeader());
+    }
+  }
+  return ret;
+}
+
 #endif /* _HELPERS_H_ */
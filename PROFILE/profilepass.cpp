@@ -10,6 +10,7 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/CFG.h"
 
 #include "helpers.hpp"
 
@@ -21,10 +22,17 @@ namespace {
 struct InjectInstLog : public ModulePass {
   static char ID;
   Function* instLogFunc = nullptr;
+  Function* loopEnterLogFunc = nullptr;
+  Function* loopIterLogFunc = nullptr;
+  Function* frameExitLogFunc = nullptr;
   Function* mainFunc = nullptr;
 
   InjectInstLog() : ModulePass(ID) {}
 
+  void getAnalysisUsage(AnalysisUsage& AU) const override {
+    AU.addRequired<LoopInfoWrapperPass>();
+  }
+
   void injectInstLogAfter(Instruction* inst, size_t instId, Value* ptrVal) {
     auto* IDParam = ConstantInt::get(
       instLogFunc->getFunctionType()->getFunctionParamType(0),
@@ -40,8 +48,62 @@ struct InjectInstLog : public ModulePass {
     instLogCall->insertAfter(castPtrParam);
   }
 
+  // arguments take a new value on every call, they're logged when entering their function
+  void injectArgLog(Argument* arg, size_t argId) {
+    auto* entryInst = &*arg->getParent()->getEntryBlock().getFirstInsertionPt();
+    auto* IDParam = ConstantInt::get(instLogFunc->getFunctionType()->getFunctionParamType(0), argId);
+    auto* castPtrParam = CastInst::CreatePointerCast(arg, instLogFunc->getFunctionType()->getFunctionParamType(1), "", entryInst);
+    CallInst::Create(instLogFunc->getFunctionType(), instLogFunc, {IDParam, castPtrParam}, "", entryInst);
+  }
+
+  void injectMarkerLogBefore(Function* markerLogFunc, Instruction* inst, size_t markerPayload) {
+    auto* IDParam = ConstantInt::get(markerLogFunc->getFunctionType()->getFunctionParamType(0), markerPayload);
+    CallInst::Create(markerLogFunc->getFunctionType(), markerLogFunc, {IDParam}, "", inst);
+  }
+
+  /* Tag the trace with loop invocations and iterations so the analysis can tell in which iteration each
+     pointer was observed. Enter markers go on every edge into the header from outside the loop
+     (i.e. the preheader when there is one), iteration markers at the top of the header */
+  void injectLoopLogs(Module& m) {
+    auto loopIds = getLoopIds(m, [this](Function& f) -> LoopInfo& {
+      return getAnalysis<LoopInfoWrapperPass>(f).getLoopInfo();
+    });
+
+    for (auto& func : m) {
+      if (func.isDeclaration() || isInstLogRuntimeFunction(func)) continue;
+      for (auto& bb : func) {
+        auto it = loopIds.headerToId.find(&bb);
+        if (it == loopIds.headerToId.end()) continue;
+        size_t loopId = it->second;
+
+        for (auto* predBB : predecessors(&bb)) {
+          size_t predLoopId = loopIds.getLoopId(predBB->getTerminator());
+          if (predLoopId == loopId || loopIds.encloses(loopId, predLoopId)) continue; // backedge
+          injectMarkerLogBefore(loopEnterLogFunc, predBB->getTerminator(), loopId);
+        }
+        injectMarkerLogBefore(loopIterLogFunc, &*bb.getFirstInsertionPt(), loopId);
+      }
+    }
+  }
+
+  /* Mark the end of every frame holding profiled stack slots, so the analysis stops comparing against
+     addresses which are dead (and will be reused by the next calls) */
+  void injectFrameExitLogs(Module& m, const std::unordered_map<MemoryLocation, size_t>& memLocToId) {
+    auto frameIds = getFrameIds(m, memLocToId);
+    for (auto& func : m) {
+      auto it = frameIds.find(&func);
+      if (it == frameIds.end()) continue;
+      for (auto& bb : func) {
+        if (isa<ReturnInst>(bb.getTerminator())) injectMarkerLogBefore(frameExitLogFunc, bb.getTerminator(), it->second);
+      }
+    }
+  }
+
   bool runOnModule(Module &m) override {
     instLogFunc = m.getFunction("_inst_log");
+    loopEnterLogFunc = m.getFunction("_loop_enter_log");
+    loopIterLogFunc = m.getFunction("_loop_iter_log");
+    frameExitLogFunc = m.getFunction("_frame_exit_log");
     mainFunc = m.getFunction("main");
     assert(instLogFunc && "instLogFunc not found");
     assert(mainFunc && "mainFunc not found");
@@ -59,8 +121,10 @@ struct InjectInstLog : public ModulePass {
               auto memLocId = ptrsToLog[memLocOpt.getValue()];
               ptrsToLog.erase(memLocOpt.getValue());
               if (auto* memLocInst = dyn_cast<Instruction>(memLocPtr)) {
-                if (memLocInst->getFunction() == instLogFunc) continue; // Do not inject logging into instlogfunc - unnecessary and will cause infinite recursion
+                if (isInstLogRuntimeFunction(*memLocInst->getFunction())) continue; // Do not inject logging into instlogfunc - unnecessary and will cause infinite recursion
                 injectInstLogAfter(memLocInst, memLocId, memLocPtr);
+              } else if (auto* memLocArg = dyn_cast<Argument>(memLocPtr)) {
+                injectArgLog(memLocArg, memLocId);
               } else {
                 injectInstLogAfter(&mainFunc->getEntryBlock().front(), memLocId, memLocPtr);
               }
@@ -71,6 +135,15 @@ struct InjectInstLog : public ModulePass {
       }
     }
     assert(ptrsToLog.empty() && "Did not inject logging for every memory location!");
+
+    if (loopEnterLogFunc && loopIterLogFunc) {
+      injectLoopLogs(m);
+      changed = true;
+    }
+    if (frameExitLogFunc) {
+      injectFrameExitLogs(m, mappingToId);
+      changed = true;
+    }
     return changed;
   }
 
@@ -2,6 +2,9 @@
 #define _FP_H_
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#include "fp_trace.h"
 
 // TODO: Optimize logging with internal DS and last-second flush to file
 
@@ -18,11 +21,75 @@
 //     size_t size;
 // };
 
+FILE* _inst_log_file() {
+    static FILE* instLogFile = NULL;
+    if (instLogFile == NULL) {
+        instLogFile = fopen("log.log", "w+");
+#ifdef FP_BINARY_TRACE
+        fwrite(FP_TRACE_BINARY_MAGIC, 1, sizeof(FP_TRACE_BINARY_MAGIC) - 1, instLogFile);
+#endif
+    }
+    return instLogFile;
+}
+
+void _inst_log_record(size_t id, void* addr) {
+#ifdef FP_BINARY_TRACE
+    struct FpTraceRecord record = {id, (uint64_t)addr};
+    fwrite(&record, sizeof(record), 1, _inst_log_file());
+#else
+    fprintf(_inst_log_file(), "%zu\n%p\n", id, addr);
+#endif
+}
+
 // TODO: parameters for: function name, full instruction name, address, size of op
 // memInstType is either 'S' for stores or 'L' for loads
 void _inst_log(size_t instID, void* addr/*, size_t size, char memInstType, const char* funcName*/) {
-    static FILE* instLogFile = NULL;
-    if (instLogFile == NULL) instLogFile = fopen("log.log", "w+");
-    fprintf(instLogFile, "%zu\n%p\n"/*"%zu\n%c\n%s\n\n"*/, instID, addr/*, size, memInstType, funcName*/);
+    _inst_log_record(instID, addr);
+}
+
+// Loop markers, injected by the profile pass in loop preheaders and headers respectively.
+// The analysis keeps track of invocations and iterations itself, we only need to tell it when they start
+void _loop_enter_log(size_t loopID) {
+    _inst_log_record(FP_TRACE_LOOP_ENTER_ID, (void*)loopID);
+}
+
+void _loop_iter_log(size_t loopID) {
+    _inst_log_record(FP_TRACE_LOOP_ITER_ID, (void*)loopID);
+}
+
+// Injected before the returns of functions with profiled stack slots, their addresses get reused by later calls
+void _frame_exit_log(size_t frameID) {
+    _inst_log_record(FP_TRACE_FRAME_EXIT_ID, (void*)frameID);
+}
+
+// Misspeculation counters of the fix-ups generated by OPTIM with -fp-count-fixups. A constructor of the optimized
+// program registers every site with its {checks, hits} counters, which are written to fixups.log at exit
+struct FpFixUpSite {
+    const char* key;
+    uint64_t* counts;
+};
+
+struct FpFixUpSite* _fixup_counts_sites = NULL;
+size_t _fixup_counts_num_sites = 0;
+
+void _fixup_counts_dump(void) {
+    FILE* file = fopen("fixups.log", "w");
+    if (file == NULL) return;
+    fprintf(file, "# site checks hits hit_rate\n");
+    for (size_t i = 0; i < _fixup_counts_num_sites; ++i) {
+        uint64_t checks = _fixup_counts_sites[i].counts[0], hits = _fixup_counts_sites[i].counts[1];
+        fprintf(file, "%s %llu %llu %f\n", _fixup_counts_sites[i].key, (unsigned long long)checks, (unsigned long long)hits,
+                checks ? (double)hits / checks : 0.0);
+    }
+    fclose(file);
 }
+
+void _fixup_counts_register(const char* key, uint64_t* counts) {
+    if (_fixup_counts_num_sites == 0) atexit(_fixup_counts_dump);
+    _fixup_counts_sites = (struct FpFixUpSite*)realloc(_fixup_counts_sites, (_fixup_counts_num_sites + 1) * sizeof(struct FpFixUpSite));
+    _fixup_counts_sites[_fixup_counts_num_sites].key = key;
+    _fixup_counts_sites[_fixup_counts_num_sites].counts = counts;
+    ++_fixup_counts_num_sites;
+}
+
 #endif /* _FP_H_ */
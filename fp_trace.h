@@ -0,0 +1,35 @@
+#ifndef _FP_TRACE_H_
+#define _FP_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Layout of log.log, shared by the runtime in fp.h and the ANALYSIS pass.
+
+Every record is an (id, addr) pair, written as 2 lines ("%zu\n%p\n") by default, or, when the program is
+built with -DFP_BINARY_TRACE, as an FpTraceRecord after an FP_TRACE_BINARY_MAGIC header.
+
+Ids below FP_TRACE_FIRST_MARKER_ID are memory location ids (see getMemLocToId) and addr is the pointer value.
+Ids at or above it are markers emitted by the runtime, in which case addr carries the marker's payload
+instead of a pointer.
+*/
+
+// A loop is about to be entered, payload is the loop id (see getLoopIds)
+#define FP_TRACE_LOOP_ENTER_ID ((size_t)-1)
+// A new iteration of a loop starts, payload is the loop id
+#define FP_TRACE_LOOP_ITER_ID ((size_t)-2)
+
+// A function returns, its stack slots die. Payload is the function's frame id (see getFrameIds)
+#define FP_TRACE_FRAME_EXIT_ID ((size_t)-3)
+
+#define FP_TRACE_FIRST_MARKER_ID ((size_t)-3)
+
+#define FP_TRACE_BINARY_MAGIC "FPTRACE1"
+
+struct FpTraceRecord {
+    uint64_t id;
+    uint64_t addr;
+};
+
+#endif /* _FP_TRACE_H_ */